@@ -0,0 +1,352 @@
+#include "libmygit.hpp"
+#include "internal.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <ostream>
+#include <zlib.h>
+
+namespace mygit
+{
+
+using namespace std;
+
+namespace
+{
+
+const size_t TAR_BLOCK = 512;
+const size_t PREFETCH_WINDOW = 32;    // blobs inflated ahead of the writer
+const size_t OUTPUT_CHUNK = 1 << 16;  // bytes handed to the stream / deflate at a time
+
+struct ArchiveEntry
+{
+    string path;
+    string mode; // tree mode, "40000" for directories
+    string hash;
+};
+
+Status collectEntries(const ObjectDatabase &objects, const string &treeHash, const string &prefix,
+                      vector<ArchiveEntry> &entries)
+{
+    Result<vector<TreeEntry>> tree = objects.readTree(treeHash);
+    if (!tree)
+        return std::unexpected(tree.error());
+
+    for (const auto &entry : *tree)
+    {
+        if (entry.mode == "160000")
+            continue; // submodules have no content here
+        entries.push_back(ArchiveEntry{prefix + entry.name, entry.mode, entry.hash});
+        if (entry.isTree())
+        {
+            Status status = collectEntries(objects, entry.hash, prefix + entry.name + "/", entries);
+            if (!status)
+                return status;
+        }
+    }
+    return {};
+}
+
+// Buffers tar output and optionally gzips it on the way to the stream
+class TarSink
+{
+public:
+    TarSink(ostream &out, bool gzip) : out(out), gzip(gzip)
+    {
+        if (gzip)
+        {
+            // windowBits 15 + 16 selects the gzip wrapper
+            ok = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+            zsInitialized = ok;
+        }
+    }
+
+    ~TarSink()
+    {
+        if (zsInitialized)
+            deflateEnd(&zs);
+    }
+
+    void write(const char *data, size_t size)
+    {
+        while (size > 0 && ok)
+        {
+            size_t n = min(size, OUTPUT_CHUNK - buffer.size());
+            buffer.append(data, n);
+            data += n;
+            size -= n;
+            if (buffer.size() == OUTPUT_CHUNK)
+                flushBuffer(false);
+        }
+    }
+
+    void pad(size_t size)
+    {
+        static const char zeros[TAR_BLOCK] = {};
+        size_t remainder = size % TAR_BLOCK;
+        if (remainder)
+            write(zeros, TAR_BLOCK - remainder);
+    }
+
+    Status finish()
+    {
+        flushBuffer(true);
+        out.flush();
+        if (!ok || !out)
+            return fail(gzip && !out.fail() ? ErrorCode::CompressionError : ErrorCode::IoError,
+                        "Failed to write archive");
+        return {};
+    }
+
+private:
+    void flushBuffer(bool last)
+    {
+        if (!ok)
+            return;
+        if (!gzip)
+        {
+            out.write(buffer.data(), static_cast<streamsize>(buffer.size()));
+        }
+        else
+        {
+            zs.next_in = reinterpret_cast<Bytef *>(buffer.data());
+            zs.avail_in = buffer.size();
+            char compressed[OUTPUT_CHUNK];
+            int result;
+            do
+            {
+                zs.next_out = reinterpret_cast<Bytef *>(compressed);
+                zs.avail_out = sizeof(compressed);
+                result = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+                if (result == Z_STREAM_ERROR)
+                {
+                    ok = false;
+                    return;
+                }
+                out.write(compressed, static_cast<streamsize>(sizeof(compressed) - zs.avail_out));
+            } while (zs.avail_out == 0 || (last && result != Z_STREAM_END));
+        }
+        buffer.clear();
+        if (!out)
+            ok = false;
+    }
+
+    ostream &out;
+    bool gzip;
+    bool ok = true;
+    bool zsInitialized = false;
+    z_stream zs{};
+    string buffer;
+};
+
+void setOctal(char *field, size_t width, uint64_t value)
+{
+    // width - 1 digits followed by NUL, callers keep value within range
+    char digits[32];
+    int len = snprintf(digits, sizeof(digits), "%0*llo", static_cast<int>(width - 1),
+                       static_cast<unsigned long long>(value));
+    memcpy(field, digits + len - (width - 1), width - 1);
+    field[width - 1] = '\0';
+}
+
+// "<len> key=value\n" where len counts the whole record including itself
+string paxRecord(const string &key, const string &value)
+{
+    size_t body = 1 + key.size() + 1 + value.size() + 1;
+    size_t len = body + to_string(body).size();
+    if (to_string(len).size() != to_string(body).size())
+        ++len;
+    return to_string(len) + " " + key + "=" + value + "\n";
+}
+
+// ustar holds names up to 100 bytes, or longer ones split at a '/' into prefix (155) + name (100)
+bool splitUstarName(const string &name, string &prefix, string &shortName)
+{
+    prefix.clear();
+    shortName = name;
+    if (name.size() <= 100)
+        return true;
+
+    size_t split = name.rfind('/', 155);
+    if (split == string::npos || split == 0 || name.size() - split - 1 > 100)
+        return false;
+    prefix = name.substr(0, split);
+    shortName = name.substr(split + 1);
+    return true;
+}
+
+void writeHeader(TarSink &sink, const string &name, char typeflag, uint64_t mode, uint64_t size,
+                 int64_t mtime, const string &linkname = "")
+{
+    char header[TAR_BLOCK] = {};
+
+    string prefix, shortName;
+    if (!splitUstarName(name, prefix, shortName))
+        shortName = name.substr(0, 100); // the pax header written before us carries the real path
+
+    memcpy(header, shortName.data(), min<size_t>(shortName.size(), 100));
+    setOctal(header + 100, 8, mode);
+    setOctal(header + 108, 8, 0);
+    setOctal(header + 116, 8, 0);
+    setOctal(header + 124, 12, size < 077777777777ULL ? size : 0);
+    setOctal(header + 136, 12, static_cast<uint64_t>(max<int64_t>(mtime, 0)));
+    memset(header + 148, ' ', 8);
+    header[156] = typeflag;
+    memcpy(header + 157, linkname.data(), min<size_t>(linkname.size(), 100));
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+    memcpy(header + 265, "root", 4);
+    memcpy(header + 297, "root", 4);
+    memcpy(header + 345, prefix.data(), min<size_t>(prefix.size(), 155));
+
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < TAR_BLOCK; ++i)
+        checksum += static_cast<unsigned char>(header[i]);
+    snprintf(header + 148, 8, "%06o", checksum);
+    header[155] = ' ';
+
+    sink.write(header, TAR_BLOCK);
+}
+
+void writeEntry(TarSink &sink, const string &name, char typeflag, uint64_t mode, const string &content,
+                int64_t mtime, const string &linkname = "")
+{
+    // Anything ustar cannot hold goes into a pax extended header first
+    string pax;
+    string prefix, shortName;
+    if (!splitUstarName(name, prefix, shortName))
+        pax += paxRecord("path", name);
+    if (linkname.size() > 100)
+        pax += paxRecord("linkpath", linkname);
+    if (content.size() >= 077777777777ULL)
+        pax += paxRecord("size", to_string(content.size()));
+    if (!pax.empty())
+    {
+        writeHeader(sink, "PaxHeader", 'x', 0644, pax.size(), mtime);
+        sink.write(pax.data(), pax.size());
+        sink.pad(pax.size());
+    }
+
+    writeHeader(sink, name, typeflag, mode, content.size(), mtime, linkname.substr(0, 100));
+    sink.write(content.data(), content.size());
+    sink.pad(content.size());
+}
+
+} // namespace
+
+Status writeArchive(const ObjectDatabase &objects, const string &commitHash, ArchiveFormat format,
+                    const string &prefix, ostream &out)
+{
+    Result<Commit> commit = objects.readCommit(commitHash);
+    if (!commit)
+        return std::unexpected(commit.error());
+    int64_t mtime = commitTime(*commit);
+
+    vector<ArchiveEntry> entries;
+    Status status = collectEntries(objects, commit->tree, prefix, entries);
+    if (!status)
+        return status;
+
+    vector<size_t> blobIndexes;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (entries[i].mode != "40000")
+            blobIndexes.push_back(i);
+    }
+
+    // Prefetch ring: workers inflate up to PREFETCH_WINDOW blobs ahead of the writer
+    struct Slot
+    {
+        bool ready = false;
+        optional<Error> error;
+        string content;
+    };
+    vector<Slot> slots(PREFETCH_WINDOW);
+    mutex m;
+    condition_variable changed;
+    size_t nextToClaim = 0, written = 0;
+    bool stop = false;
+
+    WorkerGroup workers(workerCount(blobIndexes.size()), [&]
+    {
+        while (true)
+        {
+            size_t i;
+            {
+                unique_lock<mutex> lock(m);
+                changed.wait(lock, [&] { return stop || nextToClaim >= blobIndexes.size() ||
+                                                nextToClaim < written + PREFETCH_WINDOW; });
+                if (stop || nextToClaim >= blobIndexes.size())
+                    return;
+                i = nextToClaim++;
+            }
+
+            Result<Object> blob = objects.read(entries[blobIndexes[i]].hash);
+
+            lock_guard<mutex> lock(m);
+            Slot &slot = slots[i % PREFETCH_WINDOW];
+            if (blob)
+                slot.content = std::move(blob->content);
+            else
+                slot.error = blob.error();
+            slot.ready = true;
+            changed.notify_all();
+        }
+    });
+
+    TarSink sink(out, format == ArchiveFormat::TarGz);
+
+    string global = paxRecord("comment", commitHash);
+    writeHeader(sink, "pax_global_header", 'g', 0666, global.size(), mtime);
+    sink.write(global.data(), global.size());
+    sink.pad(global.size());
+
+    if (!prefix.empty() && prefix.back() == '/')
+        writeEntry(sink, prefix, '5', 0755, "", mtime);
+
+    size_t blobCursor = 0;
+    for (const auto &entry : entries)
+    {
+        if (entry.mode == "40000")
+        {
+            writeEntry(sink, entry.path + "/", '5', 0755, "", mtime);
+            continue;
+        }
+
+        Slot taken;
+        {
+            unique_lock<mutex> lock(m);
+            Slot &slot = slots[blobCursor % PREFETCH_WINDOW];
+            changed.wait(lock, [&] { return slot.ready; });
+            taken = std::move(slot);
+            slot = Slot();
+            ++written;
+            ++blobCursor;
+            if (taken.error)
+                stop = true;
+            changed.notify_all();
+        }
+        if (taken.error)
+        {
+            status = std::unexpected(*taken.error);
+            break;
+        }
+
+        if (entry.mode == "120000")
+            writeEntry(sink, entry.path, '2', 0777, "", mtime, taken.content);
+        else
+            writeEntry(sink, entry.path, '0', entry.mode == "100755" ? 0755 : 0644, taken.content, mtime);
+    }
+
+    workers.join();
+    if (!status)
+        return status;
+
+    // End of archive: two zero blocks
+    static const char zeros[2 * TAR_BLOCK] = {};
+    sink.write(zeros, sizeof(zeros));
+    return sink.finish();
+}
+
+} // namespace mygit
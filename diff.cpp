@@ -0,0 +1,636 @@
+#include "libmygit.hpp"
+#include "internal.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace mygit
+{
+
+using namespace std;
+
+vector<string> splitLines(const string &content)
+{
+    vector<string> lines;
+    size_t start = 0;
+    while (start < content.size())
+    {
+        size_t end = content.find('\n', start);
+        end = end == string::npos ? content.size() : end + 1;
+        lines.push_back(content.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+namespace
+{
+
+// Past this many edits a box is split at the furthest point reached instead of the middle
+// snake, so pathological inputs stay O(N) per box (git's xdiff uses the same floor)
+const long MIN_DIFF_COST = 256;
+
+struct Box
+{
+    long x0, x1, y0, y1;
+};
+
+// Finds a point on a shortest edit path through box by running Myers forward from the top
+// left and backward from the bottom right until they meet. Only the two V arrays are kept,
+// so memory stays linear. Returns false when the sides share nothing.
+bool splitBox(const vector<int> &x, const vector<int> &y, const Box &box, vector<long> &vf, vector<long> &vb,
+              long &splitX, long &splitY)
+{
+    const long n = box.x1 - box.x0, m = box.y1 - box.y0;
+    const long maxD = (n + m + 1) / 2;
+    const long offset = maxD + 1;
+    fill(vf.begin(), vf.begin() + 2 * offset + 1, -1);
+    fill(vb.begin(), vb.begin() + 2 * offset + 1, -1);
+    vf[offset + 1] = 0;
+    vb[offset + 1] = 0;
+
+    const long delta = n - m;
+    const bool oddDelta = delta % 2 != 0;
+    const long maxCost = max(MIN_DIFF_COST, static_cast<long>(sqrt(static_cast<double>(n + m))));
+    // Diagonals that ran off the box are not extended again
+    long fStart = 0, fEnd = 0, bStart = 0, bEnd = 0;
+    long bestX = -1, bestY = -1;
+
+    for (long d = 0; d <= maxD; ++d)
+    {
+        if (d > maxCost && bestX >= 0)
+        {
+            splitX = bestX;
+            splitY = bestY;
+            return true;
+        }
+
+        for (long k = -d + fStart; k <= d - fEnd; k += 2)
+        {
+            long px = (k == -d || (k != d && vf[offset + k - 1] < vf[offset + k + 1])) ? vf[offset + k + 1]
+                                                                                      : vf[offset + k - 1] + 1;
+            long py = px - k;
+            while (px < n && py < m && x[box.x0 + px] == y[box.y0 + py])
+            {
+                ++px;
+                ++py;
+            }
+            vf[offset + k] = px;
+            if (px > n)
+                fEnd += 2;
+            else if (py > m)
+                fStart += 2;
+            else
+            {
+                if (px + py > bestX + bestY)
+                {
+                    bestX = px;
+                    bestY = py;
+                }
+                long kb = offset + delta - k;
+                if (oddDelta && kb >= 0 && kb <= 2 * offset && vb[kb] != -1 && px >= n - vb[kb])
+                {
+                    splitX = px;
+                    splitY = py;
+                    return true;
+                }
+            }
+        }
+
+        for (long k = -d + bStart; k <= d - bEnd; k += 2)
+        {
+            long px = (k == -d || (k != d && vb[offset + k - 1] < vb[offset + k + 1])) ? vb[offset + k + 1]
+                                                                                      : vb[offset + k - 1] + 1;
+            long py = px - k;
+            while (px < n && py < m && x[box.x1 - 1 - px] == y[box.y1 - 1 - py])
+            {
+                ++px;
+                ++py;
+            }
+            vb[offset + k] = px;
+            if (px > n)
+                bEnd += 2;
+            else if (py > m)
+                bStart += 2;
+            else
+            {
+                long kf = offset + delta - k;
+                if (!oddDelta && kf >= 0 && kf <= 2 * offset && vf[kf] != -1 && vf[kf] >= n - px)
+                {
+                    splitX = vf[kf];
+                    splitY = vf[kf] - (kf - offset);
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+vector<long> matchLines(const vector<string> &a, const vector<string> &b)
+{
+    vector<long> match(a.size(), -1);
+
+    // Compare line ids instead of strings. A line missing from the other side can never be
+    // matched, dropping it up front makes wholesale rewrites cheap.
+    unordered_map<string, int> ids;
+    vector<int> idsA, idsB;
+    for (const string &line : a)
+        idsA.push_back(ids.emplace(line, static_cast<int>(ids.size())).first->second);
+    for (const string &line : b)
+        idsB.push_back(ids.emplace(line, static_cast<int>(ids.size())).first->second);
+    vector<char> inA(ids.size()), inB(ids.size());
+    for (int id : idsA)
+        inA[id] = 1;
+    for (int id : idsB)
+        inB[id] = 1;
+
+    vector<int> x, y;
+    vector<long> fromX, fromY; // positions in a and b
+    for (size_t i = 0; i < idsA.size(); ++i)
+    {
+        if (inB[idsA[i]])
+        {
+            x.push_back(idsA[i]);
+            fromX.push_back(static_cast<long>(i));
+        }
+    }
+    for (size_t i = 0; i < idsB.size(); ++i)
+    {
+        if (inA[idsB[i]])
+        {
+            y.push_back(idsB[i]);
+            fromY.push_back(static_cast<long>(i));
+        }
+    }
+
+    vector<long> vf(x.size() + y.size() + 4), vb(vf.size());
+    vector<Box> pending{Box{0, static_cast<long>(x.size()), 0, static_cast<long>(y.size())}};
+    while (!pending.empty())
+    {
+        Box box = pending.back();
+        pending.pop_back();
+
+        // Common prefix and suffix never need the edit graph
+        while (box.x0 < box.x1 && box.y0 < box.y1 && x[box.x0] == y[box.y0])
+            match[fromX[box.x0++]] = fromY[box.y0++];
+        while (box.x0 < box.x1 && box.y0 < box.y1 && x[box.x1 - 1] == y[box.y1 - 1])
+            match[fromX[--box.x1]] = fromY[--box.y1];
+        if (box.x0 == box.x1 || box.y0 == box.y1)
+            continue;
+
+        long splitX, splitY;
+        if (!splitBox(x, y, box, vf, vb, splitX, splitY))
+            continue; // one replaced block
+        pending.push_back(Box{box.x0 + splitX, box.x1, box.y0 + splitY, box.y1});
+        pending.push_back(Box{box.x0, box.x0 + splitX, box.y0, box.y0 + splitY});
+    }
+    return match;
+}
+
+namespace
+{
+
+const size_t CHUNK_LIMIT = 64;     // fingerprinted chunks end at a newline or after this many bytes
+const size_t CANDIDATES_KEPT = 4;  // best sources remembered per destination
+
+Status collectSide(const ObjectDatabase &objects, const string &treeHash, const string &prefix, bool isNew,
+                   vector<FileChange> &changes)
+{
+    Result<vector<TreeEntry>> entries = objects.readTree(treeHash);
+    if (!entries)
+        return std::unexpected(entries.error());
+
+    for (const auto &entry : *entries)
+    {
+        string path = prefix + entry.name;
+        if (entry.isTree())
+        {
+            Status status = collectSide(objects, entry.hash, path + "/", isNew, changes);
+            if (!status)
+                return status;
+        }
+        else if (isNew)
+        {
+            changes.push_back(FileChange{ChangeType::Added, "", path, "", entry.mode, "", entry.hash});
+        }
+        else
+        {
+            changes.push_back(FileChange{ChangeType::Deleted, path, "", entry.mode, "", entry.hash, ""});
+        }
+    }
+    return {};
+}
+
+Status collectChanges(const ObjectDatabase &objects, const string &oldTree, const string &newTree,
+                      const string &prefix, vector<FileChange> &changes)
+{
+    if (oldTree == newTree)
+        return {}; // identical subtrees are never read
+
+    map<string, array<optional<TreeEntry>, 2>> byName;
+    for (int side = 0; side < 2; ++side)
+    {
+        const string &hash = side == 0 ? oldTree : newTree;
+        if (hash.empty())
+            continue;
+        Result<vector<TreeEntry>> entries = objects.readTree(hash);
+        if (!entries)
+            return std::unexpected(entries.error());
+        for (auto &entry : *entries)
+            byName[entry.name][side] = std::move(entry);
+    }
+
+    for (const auto &[name, sides] : byName)
+    {
+        const auto &[o, n] = sides;
+        string path = prefix + name;
+        if (o && n && o->mode == n->mode && o->hash == n->hash)
+            continue;
+
+        if (o && n && !o->isTree() && !n->isTree())
+        {
+            changes.push_back(FileChange{ChangeType::Modified, path, path, o->mode, n->mode, o->hash, n->hash});
+            continue;
+        }
+
+        Status status;
+        if (o && n && o->isTree() && n->isTree())
+        {
+            status = collectChanges(objects, o->hash, n->hash, path + "/", changes);
+        }
+        else
+        {
+            // Added, deleted, or a file replaced by a directory (or the other way round)
+            if (o && o->isTree())
+                status = collectSide(objects, o->hash, path + "/", false, changes);
+            else if (o)
+                changes.push_back(FileChange{ChangeType::Deleted, path, "", o->mode, "", o->hash, ""});
+            if (status && n && n->isTree())
+                status = collectSide(objects, n->hash, path + "/", true, changes);
+            else if (status && n)
+                changes.push_back(FileChange{ChangeType::Added, "", path, "", n->mode, "", n->hash});
+        }
+        if (!status)
+            return status;
+    }
+    return {};
+}
+
+// Sorted (chunk hash, bytes) pairs with equal hashes merged, so two files compare in one linear pass
+struct Signature
+{
+    vector<pair<uint64_t, uint32_t>> chunks;
+    size_t size = 0;
+};
+
+Signature makeSignature(const string &content)
+{
+    Signature signature;
+    signature.size = content.size();
+
+    size_t start = 0;
+    while (start < content.size())
+    {
+        // FNV-1a over the chunk
+        uint64_t hash = 1469598103934665603ULL;
+        size_t end = start;
+        while (end < content.size() && end - start < CHUNK_LIMIT)
+        {
+            hash = (hash ^ static_cast<unsigned char>(content[end])) * 1099511628211ULL;
+            if (content[end++] == '\n')
+                break;
+        }
+        signature.chunks.emplace_back(hash, static_cast<uint32_t>(end - start));
+        start = end;
+    }
+
+    sort(signature.chunks.begin(), signature.chunks.end());
+    size_t out = 0;
+    for (size_t i = 0; i < signature.chunks.size(); ++i)
+    {
+        if (out > 0 && signature.chunks[out - 1].first == signature.chunks[i].first)
+            signature.chunks[out - 1].second += signature.chunks[i].second;
+        else
+            signature.chunks[out++] = signature.chunks[i];
+    }
+    signature.chunks.resize(out);
+    return signature;
+}
+
+// Bytes of b that also appear in a, over the size of the larger one, as a percentage
+int similarity(const Signature &a, const Signature &b)
+{
+    size_t common = 0;
+    auto x = a.chunks.begin(), y = b.chunks.begin();
+    while (x != a.chunks.end() && y != b.chunks.end())
+    {
+        if (x->first < y->first)
+            ++x;
+        else if (y->first < x->first)
+            ++y;
+        else
+            common += min((x++)->second, (y++)->second);
+    }
+    return static_cast<int>(common * 100 / max(a.size, b.size));
+}
+
+struct Pairing
+{
+    int score;
+    size_t destination; // index into changes
+    size_t source;
+};
+
+void pairChange(FileChange &destination, const FileChange &source, ChangeType type, int score)
+{
+    destination.type = type;
+    destination.oldPath = source.oldPath;
+    destination.oldMode = source.oldMode;
+    destination.oldHash = source.oldHash;
+    destination.similarity = score;
+}
+
+Status detectRenames(const ObjectDatabase &objects, vector<FileChange> &changes, const DiffOptions &options)
+{
+    vector<size_t> destinations, sources;
+    for (size_t i = 0; i < changes.size(); ++i)
+    {
+        if (changes[i].type == ChangeType::Added)
+            destinations.push_back(i);
+        else if (changes[i].type == ChangeType::Deleted ||
+                 (options.detectCopies && changes[i].type == ChangeType::Modified))
+            sources.push_back(i);
+    }
+    if (destinations.empty() || sources.empty())
+        return {};
+
+    vector<bool> renamed(changes.size(), false); // deleted sources already taken by a rename
+    auto take = [&](size_t dst, size_t src, int score) -> bool
+    {
+        if (changes[src].type == ChangeType::Deleted && !renamed[src])
+        {
+            renamed[src] = true;
+            pairChange(changes[dst], changes[src], ChangeType::Renamed, score);
+            return true;
+        }
+        if (!options.detectCopies)
+            return false;
+        pairChange(changes[dst], changes[src], ChangeType::Copied, score);
+        return true;
+    };
+
+    // Exact pass: same object id, preferring a source with the same file name
+    unordered_map<string, vector<size_t>> byHash;
+    for (size_t src : sources)
+        byHash[changes[src].oldHash].push_back(src);
+
+    vector<size_t> remaining;
+    for (size_t dst : destinations)
+    {
+        auto it = byHash.find(changes[dst].newHash);
+        bool paired = false;
+        if (it != byHash.end())
+        {
+            vector<size_t> candidates = it->second;
+            stable_partition(candidates.begin(), candidates.end(), [&](size_t src)
+                             { return baseName(changes[src].oldPath) == baseName(changes[dst].newPath); });
+            stable_partition(candidates.begin(), candidates.end(), [&](size_t src)
+                             { return changes[src].type == ChangeType::Deleted && !renamed[src]; });
+            for (size_t src : candidates)
+            {
+                if ((paired = take(dst, src, 100)))
+                    break;
+            }
+        }
+        if (!paired)
+            remaining.push_back(dst);
+    }
+
+    vector<size_t> candidates;
+    for (size_t src : sources)
+    {
+        if (options.detectCopies || !renamed[src])
+            candidates.push_back(src);
+    }
+    if (remaining.empty() || candidates.empty() ||
+        remaining.size() * candidates.size() > options.limit * options.limit)
+        return {};
+
+    // Signatures for every blob still in play, built in parallel
+    vector<string> hashes;
+    for (size_t dst : remaining)
+        hashes.push_back(changes[dst].newHash);
+    for (size_t src : candidates)
+        hashes.push_back(changes[src].oldHash);
+
+    vector<Signature> signatures(hashes.size());
+    vector<optional<Error>> errors(hashes.size());
+    parallelFor(hashes.size(), [&](size_t i)
+    {
+        Result<Object> blob = objects.read(hashes[i]);
+        if (blob)
+            signatures[i] = makeSignature(blob->content);
+        else
+            errors[i] = blob.error();
+    });
+    for (const auto &error : errors)
+    {
+        if (error)
+            return std::unexpected(*error);
+    }
+
+    // Each destination keeps its few best sources; sizes too far apart are never compared
+    vector<vector<Pairing>> best(remaining.size());
+    parallelFor(remaining.size(), [&](size_t d)
+    {
+        const Signature &dst = signatures[d];
+        if (dst.size == 0)
+            return; // empty files would pair with anything
+        for (size_t s = 0; s < candidates.size(); ++s)
+        {
+            const Signature &src = signatures[remaining.size() + s];
+            if (src.size == 0 || min(src.size, dst.size) * 100 < max(src.size, dst.size) * options.threshold)
+                continue;
+            int score = similarity(src, dst);
+            if (score < options.threshold)
+                continue;
+
+            vector<Pairing> &kept = best[d];
+            kept.push_back(Pairing{score, remaining[d], candidates[s]});
+            sort(kept.begin(), kept.end(), [](const Pairing &x, const Pairing &y) { return x.score > y.score; });
+            if (kept.size() > CANDIDATES_KEPT)
+                kept.pop_back();
+        }
+    });
+
+    // Highest scores claim their sources first
+    vector<Pairing> pairings;
+    for (const auto &kept : best)
+        pairings.insert(pairings.end(), kept.begin(), kept.end());
+    stable_sort(pairings.begin(), pairings.end(), [](const Pairing &x, const Pairing &y) { return x.score > y.score; });
+
+    vector<bool> paired(changes.size(), false);
+    for (const Pairing &pairing : pairings)
+    {
+        if (!paired[pairing.destination] && take(pairing.destination, pairing.source, pairing.score))
+            paired[pairing.destination] = true;
+    }
+    return {};
+}
+
+} // namespace
+
+Result<vector<FileChange>> diffTrees(const ObjectDatabase &objects, const string &oldTree, const string &newTree,
+                                     const DiffOptions &options)
+{
+    vector<FileChange> changes;
+    Status status = collectChanges(objects, oldTree, newTree, "", changes);
+    if (status && options.detectRenames)
+        status = detectRenames(objects, changes, options);
+    if (!status)
+        return std::unexpected(status.error());
+
+    // Sources consumed by a rename are no longer deletions
+    vector<bool> consumed(changes.size(), false);
+    unordered_map<string, size_t> deletedAt;
+    for (size_t i = 0; i < changes.size(); ++i)
+    {
+        if (changes[i].type == ChangeType::Deleted)
+            deletedAt[changes[i].oldPath] = i;
+    }
+    for (const auto &change : changes)
+    {
+        auto it = change.type == ChangeType::Renamed ? deletedAt.find(change.oldPath) : deletedAt.end();
+        if (it != deletedAt.end())
+            consumed[it->second] = true;
+    }
+
+    vector<FileChange> result;
+    for (size_t i = 0; i < changes.size(); ++i)
+    {
+        if (!consumed[i])
+            result.push_back(std::move(changes[i]));
+    }
+    auto key = [](const FileChange &change) -> const string &
+    { return change.newPath.empty() ? change.oldPath : change.newPath; };
+    stable_sort(result.begin(), result.end(),
+                [&](const FileChange &x, const FileChange &y) { return key(x) < key(y); });
+    return result;
+}
+
+Result<string> formatPatch(const ObjectDatabase &objects, const FileChange &change)
+{
+    const string &oldName = change.oldPath.empty() ? change.newPath : change.oldPath;
+    const string &newName = change.newPath.empty() ? change.oldPath : change.newPath;
+
+    string out = "diff --git a/" + oldName + " b/" + newName + "\n";
+    if (change.type == ChangeType::Added)
+        out += "new file mode " + change.newMode + "\n";
+    else if (change.type == ChangeType::Deleted)
+        out += "deleted file mode " + change.oldMode + "\n";
+    else if (change.oldMode != change.newMode)
+        out += "old mode " + change.oldMode + "\nnew mode " + change.newMode + "\n";
+
+    if (change.type == ChangeType::Renamed || change.type == ChangeType::Copied)
+    {
+        string verb = change.type == ChangeType::Renamed ? "rename" : "copy";
+        out += "similarity index " + to_string(change.similarity) + "%\n";
+        out += verb + " from " + change.oldPath + "\n" + verb + " to " + change.newPath + "\n";
+    }
+    if (change.oldHash == change.newHash)
+        return out;
+
+    const string zeros(7, '0');
+    out += "index " + (change.oldHash.empty() ? zeros : change.oldHash.substr(0, 7)) + ".." +
+           (change.newHash.empty() ? zeros : change.newHash.substr(0, 7));
+    if (change.type == ChangeType::Modified && change.oldMode == change.newMode)
+        out += " " + change.newMode;
+    out += "\n";
+
+    string oldContent, newContent;
+    for (auto [hash, content] : {pair{&change.oldHash, &oldContent}, pair{&change.newHash, &newContent}})
+    {
+        if (hash->empty())
+            continue;
+        Result<Object> blob = objects.read(*hash);
+        if (!blob)
+            return std::unexpected(blob.error());
+        *content = std::move(blob->content);
+    }
+
+    string oldLabel = change.oldPath.empty() ? "/dev/null" : "a/" + change.oldPath;
+    string newLabel = change.newPath.empty() ? "/dev/null" : "b/" + change.newPath;
+    if (isBinary(oldContent) || isBinary(newContent))
+        return out + "Binary files " + oldLabel + " and " + newLabel + " differ\n";
+    out += "--- " + oldLabel + "\n+++ " + newLabel + "\n";
+
+    // Edit script from the line matching: ' ' keep, '-' remove, '+' insert
+    vector<string> a = splitLines(oldContent), b = splitLines(newContent);
+    vector<long> match = matchLines(a, b);
+    vector<pair<char, const string *>> ops;
+    size_t i = 0, j = 0;
+    while (i < a.size() || j < b.size())
+    {
+        if (i < a.size() && match[i] < 0)
+            ops.emplace_back('-', &a[i++]);
+        else if (j < b.size() && (i >= a.size() || match[i] > static_cast<long>(j)))
+            ops.emplace_back('+', &b[j++]);
+        else
+        {
+            ops.emplace_back(' ', &a[i++]);
+            ++j;
+        }
+    }
+
+    // Changes closer than twice the context share a hunk
+    const size_t context = 3;
+    size_t pos = 0, oldLine = 0, newLine = 0; // lines consumed before pos
+    while (pos < ops.size())
+    {
+        size_t first = pos;
+        while (first < ops.size() && ops[first].first == ' ')
+            ++first;
+        if (first == ops.size())
+            break;
+
+        size_t last = first;
+        for (size_t k = first + 1; k < ops.size() && k <= last + 2 * context + 1; ++k)
+        {
+            if (ops[k].first != ' ')
+                last = k;
+        }
+        size_t begin = first - min(context, first - pos);
+        size_t end = min(ops.size(), last + 1 + context);
+
+        // Skip the unchanged lines before the hunk
+        oldLine += begin - pos;
+        newLine += begin - pos;
+
+        size_t oldCount = 0, newCount = 0;
+        string body;
+        for (size_t k = begin; k < end; ++k)
+        {
+            char kind = ops[k].first;
+            const string &line = *ops[k].second;
+            oldCount += kind != '+';
+            newCount += kind != '-';
+            body += kind + line;
+            if (line.empty() || line.back() != '\n')
+                body += "\n\\ No newline at end of file\n";
+        }
+
+        out += "@@ -" + to_string(oldCount ? oldLine + 1 : oldLine) + "," + to_string(oldCount) + " +" +
+               to_string(newCount ? newLine + 1 : newLine) + "," + to_string(newCount) + " @@\n" + body;
+        oldLine += oldCount;
+        newLine += newCount;
+        pos = end;
+    }
+    return out;
+}
+
+} // namespace mygit
@@ -0,0 +1,376 @@
+#include "libmygit.hpp"
+#include "internal.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mygit
+{
+
+using namespace std;
+
+namespace
+{
+
+const char *const AUTO_GC_SAMPLE_DIR = "17"; // any fan-out directory holds about 1/256 of the objects
+const char *const GC_LOG = "gc.log";          // loose object estimate right after the last gc
+const int64_t GC_LOCK_STALE_SECONDS = 12 * 60 * 60; // a gc never runs this long, the lock is left over
+
+string hostName()
+{
+    char name[256] = {};
+    gethostname(name, sizeof(name) - 1);
+    return name;
+}
+
+// gc.lock holds "<pid> <host>" of its owner. It is stale once older than GC_LOCK_STALE_SECONDS
+// or when its owner ran here and is gone. A lock still being written counts as held.
+bool isStaleGcLock(const string &lockPath)
+{
+    struct stat st;
+    if (stat(lockPath.c_str(), &st) != 0)
+        return false;
+    if (time(nullptr) - st.st_mtime > GC_LOCK_STALE_SECONDS)
+        return true;
+
+    Result<string> content = readFile(lockPath);
+    if (!content)
+        return false;
+    size_t space = content->find(' ');
+    if (space == string::npos)
+        return false;
+    long pid = strtol(content->c_str(), nullptr, 10);
+    string host = content->substr(space + 1);
+    if (!host.empty() && host.back() == '\n')
+        host.pop_back();
+    return pid > 0 && host == hostName() && kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH;
+}
+
+Status acquireGcLock(const string &lockPath)
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        int fd = ::open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0)
+        {
+            string owner = to_string(getpid()) + " " + hostName() + "\n";
+            bool written = ::write(fd, owner.data(), owner.size()) == static_cast<ssize_t>(owner.size());
+            close(fd);
+            if (!written)
+            {
+                unlink(lockPath.c_str());
+                return fail(ErrorCode::IoError, "Failed to write " + lockPath);
+            }
+            return {};
+        }
+        if (errno != EEXIST)
+            return fail(ErrorCode::IoError, "Unable to create " + lockPath + ": " + strerror(errno));
+        if (attempt > 0 || !isStaleGcLock(lockPath))
+            break;
+        unlink(lockPath.c_str()); // left by a gc that died, take it over
+    }
+
+    string owner;
+    Result<string> content = readFile(lockPath);
+    if (content && !content->empty())
+        owner = " (" + content->substr(0, content->find_first_of(" \n")) + ")";
+    return fail(ErrorCode::Locked, "Another gc" + owner + " is running; if it is not, remove " + lockPath);
+}
+
+struct LooseObject
+{
+    string hash;
+    int64_t mtime;
+};
+
+string fanoutName(size_t i)
+{
+    const char *digits = "0123456789abcdef";
+    return string{digits[i >> 4], digits[i & 15]};
+}
+
+// Every loose object in the store, sorted by hash. Fan-out directories are scanned in parallel.
+vector<LooseObject> listLooseObjects(const string &objectsDir)
+{
+    vector<vector<LooseObject>> perDir(256);
+    parallelFor(256, [&](size_t i)
+    {
+        string dir = fanoutName(i);
+        error_code ec;
+        for (const auto &entry : filesystem::directory_iterator(objectsDir + "/" + dir, ec))
+        {
+            string hash = dir + entry.path().filename().string();
+            struct stat st;
+            if (!isHexHash(hash) || stat(entry.path().c_str(), &st) != 0)
+                continue; // tmp files and the like are not ours to judge
+            perDir[i].push_back(LooseObject{hash, static_cast<int64_t>(st.st_mtime)});
+        }
+        sort(perDir[i].begin(), perDir[i].end(),
+             [](const LooseObject &a, const LooseObject &b) { return a.hash < b.hash; });
+    });
+
+    vector<LooseObject> objects;
+    for (auto &dir : perDir)
+        move(dir.begin(), dir.end(), back_inserter(objects));
+    return objects;
+}
+
+enum class Kind
+{
+    Unknown, // roots whose type we have not looked at yet
+    Commit,
+    Tree,
+    Blob,
+};
+
+// Parallel reachability marking into one bit per loose object. Objects that only live in
+// an alternate store are not walked: whatever they reference lives there as well.
+class Marker
+{
+public:
+    Marker(const ObjectDatabase &objects, const vector<LooseObject> &loose)
+        : objects(objects), loose(loose), bits((loose.size() + 63) / 64)
+    {
+    }
+
+    void add(const string &hash, Kind kind)
+    {
+        if (kind == Kind::Blob)
+        {
+            mark(hash); // nothing below a blob, no need to queue it
+            return;
+        }
+        lock_guard<mutex> lock(m);
+        pending.emplace_back(hash, kind);
+    }
+
+    Status run()
+    {
+        WorkerGroup(workerCount(loose.size()), [this] { work(); }).join();
+        if (error)
+            return std::unexpected(*error);
+        return {};
+    }
+
+    bool marked(size_t i) const { return bits[i / 64].load(memory_order_relaxed) & (uint64_t(1) << (i % 64)); }
+
+private:
+    // True the first time a local object is marked
+    bool mark(const string &hash)
+    {
+        auto it = lower_bound(loose.begin(), loose.end(), hash,
+                              [](const LooseObject &object, const string &h) { return object.hash < h; });
+        if (it == loose.end() || it->hash != hash)
+            return false;
+        size_t i = it - loose.begin();
+        uint64_t bit = uint64_t(1) << (i % 64);
+        return !(bits[i / 64].fetch_or(bit, memory_order_relaxed) & bit);
+    }
+
+    void work()
+    {
+        while (true)
+        {
+            pair<string, Kind> item;
+            {
+                unique_lock<mutex> lock(m);
+                changed.wait(lock, [&] { return !pending.empty() || busy == 0 || error; });
+                if (pending.empty() || error)
+                {
+                    changed.notify_all();
+                    return;
+                }
+                item = std::move(pending.front());
+                pending.pop_front();
+                ++busy;
+            }
+
+            vector<pair<string, Kind>> found;
+            Status status = visit(item.first, item.second, found);
+
+            lock_guard<mutex> lock(m);
+            if (!status && !error)
+                error = status.error();
+            for (auto &child : found)
+                pending.push_back(std::move(child));
+            --busy;
+            changed.notify_all();
+        }
+    }
+
+    Status visit(const string &hash, Kind kind, vector<pair<string, Kind>> &found)
+    {
+        if (!mark(hash))
+            return {};
+
+        if (kind == Kind::Unknown)
+        {
+            Result<string> type = objects.type(hash);
+            if (!type)
+                return std::unexpected(type.error());
+            kind = *type == "commit" ? Kind::Commit : *type == "tree" ? Kind::Tree : Kind::Blob;
+        }
+
+        if (kind == Kind::Commit)
+        {
+            Result<Commit> commit = objects.readCommit(hash, CommitTree);
+            if (!commit)
+                return std::unexpected(commit.error());
+            found.emplace_back(commit->tree, Kind::Tree);
+            for (const string &parent : commit->parents)
+                found.emplace_back(parent, Kind::Commit);
+        }
+        else if (kind == Kind::Tree)
+        {
+            Result<vector<TreeEntry>> entries = objects.readTree(hash);
+            if (!entries)
+                return std::unexpected(entries.error());
+            for (const auto &entry : *entries)
+            {
+                if (entry.mode == "160000")
+                    continue; // submodule commits live elsewhere
+                if (entry.isTree())
+                    found.emplace_back(entry.hash, Kind::Tree);
+                else
+                    mark(entry.hash);
+            }
+        }
+        return {};
+    }
+
+    const ObjectDatabase &objects;
+    const vector<LooseObject> &loose;
+    vector<atomic<uint64_t>> bits;
+
+    mutex m;
+    condition_variable changed;
+    deque<pair<string, Kind>> pending;
+    size_t busy = 0;
+    optional<Error> error;
+};
+
+} // namespace
+
+size_t Repository::estimateLooseObjects() const
+{
+    size_t count = 0;
+    error_code ec;
+    for (const auto &entry : filesystem::directory_iterator(objects_->directory() + "/" + AUTO_GC_SAMPLE_DIR, ec))
+    {
+        if (entry.path().filename().string().size() == 38) // the hash minus its directory prefix
+            ++count;
+    }
+    return count * 256;
+}
+
+bool Repository::needsGc(size_t threshold) const
+{
+    size_t baseline = 0;
+    Result<string> log = readFile(gitDir_ + "/" + GC_LOG);
+    if (log)
+        baseline = strtoull(log->c_str(), nullptr, 10);
+    return estimateLooseObjects() > baseline + threshold;
+}
+
+Result<GcResult> Repository::gc(int64_t pruneBefore)
+{
+    // One gc at a time; writers are safe because rewritten objects get a fresh mtime
+    string lockPath = gitDir_ + "/gc.lock";
+    Status locked = acquireGcLock(lockPath);
+    if (!locked)
+        return std::unexpected(locked.error());
+    struct Unlock
+    {
+        string path;
+        ~Unlock() { unlink(path.c_str()); }
+    } unlock{lockPath};
+
+    const string &objectsDir = objects_->directory();
+    vector<LooseObject> loose = listLooseObjects(objectsDir);
+
+    Marker marker(*objects_, loose);
+    vector<string> tips;
+    for (const auto &[name, hash] : refs_->list("refs/"))
+        tips.push_back(hash);
+    Result<string> head = refs_->resolve("HEAD");
+    if (head)
+        tips.push_back(*head);
+    for (const string &tip : tips)
+        marker.add(tip, Kind::Unknown);
+    Result<string> mergeHead = readFile(gitDir_ + "/MERGE_HEAD");
+    if (mergeHead && isHexHash(mergeHead->substr(0, 40)))
+        marker.add(mergeHead->substr(0, 40), Kind::Commit);
+
+    Result<vector<IndexEntry>> index = readIndex();
+    if (!index)
+        return std::unexpected(index.error());
+    for (const auto &entry : *index)
+        marker.add(entry.hash, !entry.path.empty() && entry.path.back() == '/' ? Kind::Tree : Kind::Blob);
+
+    // Anything written recently may belong to a command still running, keep it and what it needs
+    for (const auto &object : loose)
+    {
+        if (object.mtime > pruneBefore)
+            marker.add(object.hash, Kind::Unknown);
+    }
+
+    Status status = marker.run();
+    if (!status)
+        return std::unexpected(status.error());
+
+    GcResult result;
+    result.objects = loose.size();
+
+    // Unreachable objects grouped by fan-out directory, each directory swept by one worker
+    vector<vector<string>> doomed(256);
+    for (size_t i = 0; i < loose.size(); ++i)
+    {
+        if (marker.marked(i))
+            ++result.reachable;
+        else
+            doomed[stoi(loose[i].hash.substr(0, 2), nullptr, 16)].push_back(loose[i].hash);
+    }
+
+    atomic<size_t> pruned{0};
+    parallelFor(256, [&](size_t i)
+    {
+        if (doomed[i].empty())
+            return;
+        string dir = objectsDir + "/" + fanoutName(i);
+        for (const string &hash : doomed[i])
+        {
+            if (unlink((dir + "/" + hash.substr(2)).c_str()) == 0)
+                ++pruned;
+        }
+        rmdir(dir.c_str()); // only succeeds once the directory is empty
+    });
+
+    result.pruned = pruned;
+
+    // gc already pays for walking all of history, bring the commit graph up to date while at it
+    for (const string &tip : tips)
+    {
+        Result<string> type = objects_->type(tip);
+        if (type && *type == "commit" && !commitGraph_->lookup(tip))
+            break;
+    }
+    status = commitGraph_->save();
+    if (!status)
+        return std::unexpected(status.error());
+
+    // Sampled like needsGc() so both sides of its comparison share the same bias
+    status = writeFileLocked(gitDir_ + "/" + GC_LOG, to_string(estimateLooseObjects()) + "\n");
+    if (!status)
+        return std::unexpected(status.error());
+    return result;
+}
+
+} // namespace mygit
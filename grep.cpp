@@ -0,0 +1,312 @@
+#include "libmygit.hpp"
+#include "internal.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <regex>
+
+namespace mygit
+{
+
+using namespace std;
+
+namespace
+{
+
+// Longest run of characters every match must contain, "" when the regex has none
+// we can prove (alternation, or nothing but classes and quantified atoms).
+string requiredLiteral(const string &pattern)
+{
+    string best, run;
+    auto endRun = [&]
+    {
+        if (run.size() > best.size())
+            best = run;
+        run.clear();
+    };
+
+    int depth = 0;
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        char c = pattern[i];
+        char nextChar = i + 1 < pattern.size() ? pattern[i + 1] : '\0';
+        bool optional = nextChar == '*' || nextChar == '?' || nextChar == '{';
+
+        if (c == '|')
+            return ""; // any branch could match on its own
+        if (c == '(')
+        {
+            ++depth;
+            endRun();
+            continue;
+        }
+        if (c == ')')
+        {
+            --depth;
+            endRun();
+            continue;
+        }
+        if (c == '[')
+        {
+            // Skip the whole bracket expression, "[]...]" keeps the first ']'
+            size_t j = i + 1;
+            if (j < pattern.size() && pattern[j] == '^')
+                ++j;
+            if (j < pattern.size() && pattern[j] == ']')
+                ++j;
+            while (j < pattern.size() && pattern[j] != ']')
+                ++j;
+            i = j;
+            endRun();
+            continue;
+        }
+        if (c == '{')
+        {
+            // Skip the whole interval, the atom before it was already treated as optional
+            size_t close = pattern.find('}', i);
+            i = close == string::npos ? pattern.size() : close;
+            endRun();
+            continue;
+        }
+
+        char literal;
+        if (c == '\\' && i + 1 < pattern.size())
+        {
+            char escaped = pattern[i + 1];
+            if (isalnum(static_cast<unsigned char>(escaped)))
+            {
+                // \d, \w, \b, back references ... are not literal
+                ++i;
+                endRun();
+                continue;
+            }
+            literal = escaped;
+            ++i;
+            nextChar = i + 1 < pattern.size() ? pattern[i + 1] : '\0';
+            optional = nextChar == '*' || nextChar == '?' || nextChar == '{';
+        }
+        else if (strchr(".^$*+?}", c))
+        {
+            endRun();
+            continue;
+        }
+        else
+        {
+            literal = c;
+        }
+
+        if (depth > 0 || optional)
+        {
+            endRun();
+            continue;
+        }
+        run += literal;
+        if (nextChar == '+')
+            endRun(); // "ab+" requires "ab", but not "abb..."
+    }
+    endRun();
+    return best;
+}
+
+// memchr on the first byte (SIMD in glibc) then memcmp to confirm
+const char *findLiteral(const char *begin, const char *end, const string &literal)
+{
+    const char first = literal[0];
+    const size_t len = literal.size();
+    while (static_cast<size_t>(end - begin) >= len)
+    {
+        const char *hit = static_cast<const char *>(memchr(begin, first, end - begin - len + 1));
+        if (!hit)
+            return nullptr;
+        if (memcmp(hit + 1, literal.data() + 1, len - 1) == 0)
+            return hit;
+        begin = hit + 1;
+    }
+    return nullptr;
+}
+
+bool pathspecMatches(const string &path, bool isTree, const vector<string> &pathspecs)
+{
+    if (pathspecs.empty())
+        return true;
+
+    for (string spec : pathspecs)
+    {
+        while (!spec.empty() && spec.back() == '/')
+            spec.pop_back();
+        if (spec.empty() || spec == ".")
+            return true;
+
+        // path is inside the spec
+        if (path.rfind(spec, 0) == 0 && (path.size() == spec.size() || path[spec.size()] == '/'))
+            return true;
+        // path is a directory on the way to the spec
+        if (isTree && spec.rfind(path, 0) == 0 && spec.size() > path.size() && spec[path.size()] == '/')
+            return true;
+    }
+    return false;
+}
+
+struct BlobToSearch
+{
+    string path;
+    string hash;
+};
+
+Status collectBlobs(const ObjectDatabase &objects, const string &treeHash, const string &prefix,
+                    const vector<string> &pathspecs, vector<BlobToSearch> &blobs)
+{
+    Result<vector<TreeEntry>> entries = objects.readTree(treeHash);
+    if (!entries)
+        return std::unexpected(entries.error());
+
+    for (const auto &entry : *entries)
+    {
+        string path = prefix + entry.name;
+        if (!pathspecMatches(path, entry.isTree(), pathspecs))
+            continue; // excluded subtrees are never read
+
+        if (entry.isTree())
+        {
+            Status status = collectBlobs(objects, entry.hash, path + "/", pathspecs, blobs);
+            if (!status)
+                return status;
+        }
+        else if (entry.mode != "160000")
+        {
+            blobs.push_back(BlobToSearch{path, entry.hash});
+        }
+    }
+    return {};
+}
+
+class Matcher
+{
+public:
+    explicit Matcher(const GrepOptions &options) : options(options)
+    {
+        auto flags = regex::extended | regex::nosubs;
+        if (options.ignoreCase)
+            flags |= regex::icase;
+        if (!options.fixedStrings)
+            re = regex(options.pattern, flags);
+
+        // Case-insensitive literals would need a folded copy of every blob, let the regex handle those
+        string candidate = options.fixedStrings ? options.pattern : requiredLiteral(options.pattern);
+        bool hasLetters = any_of(candidate.begin(), candidate.end(),
+                                 [](char c) { return isalpha(static_cast<unsigned char>(c)); });
+        if (!options.ignoreCase || !hasLetters)
+            literal = candidate;
+    }
+
+    void scan(const string &path, const string &content, vector<GrepMatch> &matches) const
+    {
+        const char *data = content.data();
+        const char *end = data + content.size();
+
+        size_t lineNumber = 1;
+        const char *counted = data; // newlines before this point are already in lineNumber
+
+        const char *pos = data;
+        while (pos < end)
+        {
+            const char *lineStart;
+            if (!literal.empty())
+            {
+                // Jump straight to the next line that can possibly match
+                const char *hit = findLiteral(pos, end, literal);
+                if (!hit)
+                    return;
+                lineStart = hit;
+                while (lineStart > pos && lineStart[-1] != '\n')
+                    --lineStart;
+            }
+            else
+            {
+                lineStart = pos;
+            }
+
+            const char *lineEnd = static_cast<const char *>(memchr(lineStart, '\n', end - lineStart));
+            if (!lineEnd)
+                lineEnd = end;
+
+            if (lineMatches(lineStart, lineEnd))
+            {
+                lineNumber += count(counted, lineStart, '\n');
+                counted = lineStart;
+                matches.push_back(GrepMatch{path, lineNumber, string(lineStart, lineEnd)});
+            }
+            pos = lineEnd + 1;
+        }
+    }
+
+private:
+    bool lineMatches(const char *begin, const char *end) const
+    {
+        if (options.fixedStrings)
+        {
+            if (!literal.empty())
+                return true; // the prefilter hit is the match
+            string line(begin, end), pattern = options.pattern;
+            auto lower = [](string &s)
+            { transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return tolower(c); }); };
+            lower(line);
+            lower(pattern);
+            return line.find(pattern) != string::npos;
+        }
+        return regex_search(begin, end, re);
+    }
+
+    const GrepOptions &options;
+    regex re;
+    string literal;
+};
+
+} // namespace
+
+Result<vector<GrepMatch>> grep(const ObjectDatabase &objects, const string &treeHash, const GrepOptions &options)
+{
+    if (options.pattern.empty())
+        return fail(ErrorCode::InvalidArgument, "Empty search pattern");
+
+    optional<Matcher> matcher;
+    try
+    {
+        matcher.emplace(options);
+    }
+    catch (const regex_error &e)
+    {
+        return fail(ErrorCode::InvalidArgument, "Invalid pattern '" + options.pattern + "': " + e.what());
+    }
+
+    vector<BlobToSearch> blobs;
+    Status status = collectBlobs(objects, treeHash, "", options.pathspecs, blobs);
+    if (!status)
+        return std::unexpected(status.error());
+
+    // Workers claim blobs in order and keep their matches per blob, so the output stays in tree order
+    vector<vector<GrepMatch>> perBlob(blobs.size());
+    vector<optional<Error>> errors(blobs.size());
+    parallelFor(blobs.size(), [&](size_t i)
+    {
+        Result<Object> blob = objects.read(blobs[i].hash);
+        if (!blob)
+        {
+            errors[i] = blob.error();
+            return;
+        }
+        if (!isBinary(blob->content))
+            matcher->scan(blobs[i].path, blob->content, perBlob[i]);
+    });
+
+    vector<GrepMatch> matches;
+    for (size_t i = 0; i < blobs.size(); ++i)
+    {
+        if (errors[i])
+            return std::unexpected(*errors[i]);
+        move(perBlob[i].begin(), perBlob[i].end(), back_inserter(matches));
+    }
+    return matches;
+}
+
+} // namespace mygit
@@ -0,0 +1,85 @@
+// Helpers shared by the library sources. Not part of the public API, not installed.
+
+#ifndef MYGIT_INTERNAL_HPP
+#define MYGIT_INTERNAL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mygit
+{
+
+// "a/b/c" -> "a/b", "" for top-level paths
+inline std::string parentDir(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+// "a/b/c" -> "c"
+inline std::string baseName(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Same heuristic as git: a NUL in the first 8000 bytes means binary
+inline bool isBinary(const std::string &content)
+{
+    return memchr(content.data(), '\0', std::min<size_t>(content.size(), 8000)) != nullptr;
+}
+
+// Threads worth starting for jobs independent items, never more than limit (the CPU count by default)
+inline size_t workerCount(size_t jobs, size_t limit = 0)
+{
+    size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    return std::max<size_t>(1, std::min(jobs, limit ? limit : cpus));
+}
+
+// count threads running the same function, joined at the latest on destruction
+class WorkerGroup
+{
+public:
+    template <typename Work>
+    WorkerGroup(size_t count, const Work &work)
+    {
+        for (size_t i = 0; i < count; ++i)
+            threads_.emplace_back(work);
+    }
+
+    ~WorkerGroup() { join(); }
+
+    void join()
+    {
+        for (auto &t : threads_)
+        {
+            if (t.joinable())
+                t.join();
+        }
+    }
+
+private:
+    std::vector<std::thread> threads_;
+};
+
+// Calls work(i) for every i below count, workers claim indexes in order
+template <typename Work>
+void parallelFor(size_t count, const Work &work, size_t maxWorkers = 0)
+{
+    if (count == 0)
+        return;
+    std::atomic<size_t> next{0};
+    WorkerGroup workers(workerCount(count, maxWorkers), [&]
+    {
+        for (size_t i = next++; i < count; i = next++)
+            work(i);
+    });
+}
+
+} // namespace mygit
+
+#endif
@@ -0,0 +1,2163 @@
+#include "libmygit.hpp"
+#include "internal.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <zlib.h>
+#include <algorithm>
+#include <openssl/sha.h>
+#include <fcntl.h>
+#include <ctime>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <numeric>
+#include <unordered_set>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <utime.h>
+#ifdef MYGIT_HAVE_URING
+#include <liburing.h>
+#endif
+
+namespace mygit
+{
+
+using namespace std;
+
+// Hashing helpers
+
+string sha1Hex(const string &data)
+{
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(data.c_str()), data.size(), hash);
+
+    stringstream ss;
+    for (int i = 0; i < SHA_DIGEST_LENGTH; ++i)
+    {
+        ss << hex << setw(2) << setfill('0') << static_cast<unsigned int>(hash[i]);
+    }
+    return ss.str();
+}
+
+int64_t commitTime(const Commit &commit)
+{
+    // mygit writes "... YYYY-MM-DD HH:MM:SS +zzzz", git writes "... <epoch> +zzzz"
+    const string &line = commit.committer;
+    size_t tzPos = line.find_last_of(' ');
+    if (tzPos == string::npos || tzPos == 0)
+        return 0;
+
+    string tz = line.substr(tzPos + 1);
+    int64_t offset = 0;
+    if (tz.size() == 5 && (tz[0] == '+' || tz[0] == '-'))
+    {
+        // A malformed zone must not throw out of log or archive
+        if (!all_of(tz.begin() + 1, tz.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); }))
+            return 0;
+        long hhmm = strtol(tz.c_str() + 1, nullptr, 10);
+        offset = (hhmm / 100) * 3600 + (hhmm % 100) * 60;
+        if (tz[0] == '-')
+            offset = -offset;
+    }
+
+    struct tm tm{};
+    if (tzPos >= 19 && sscanf(line.c_str() + tzPos - 19, "%4d-%2d-%2d %2d:%2d:%2d", &tm.tm_year, &tm.tm_mon,
+                              &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 6)
+    {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        return static_cast<int64_t>(timegm(&tm)) - offset;
+    }
+
+    size_t epochPos = line.find_last_of(' ', tzPos - 1);
+    string epoch = line.substr(epochPos == string::npos ? 0 : epochPos + 1, tzPos - epochPos - 1);
+    if (!epoch.empty() && epoch.size() < 19 &&
+        all_of(epoch.begin(), epoch.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); }))
+        return strtoll(epoch.c_str(), nullptr, 10);
+    return 0;
+}
+
+Result<int64_t> parseDate(const string &text)
+{
+    time_t now = time(nullptr);
+    if (text == "now")
+        return static_cast<int64_t>(now);
+
+    char *end = nullptr;
+    if (text.size() > 1 && text[0] == '@')
+    {
+        long long epoch = strtoll(text.c_str() + 1, &end, 10);
+        if (*end == '\0')
+            return static_cast<int64_t>(epoch);
+    }
+
+    struct tm tm{};
+    int parsed = sscanf(text.c_str(), "%4d-%2d-%2d %2d:%2d:%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+                        &tm.tm_min, &tm.tm_sec);
+    if (parsed == 3 || parsed >= 5)
+    {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        return static_cast<int64_t>(mktime(&tm));
+    }
+
+    // "2.weeks.ago", "3 days ago"
+    string relative = text;
+    replace(relative.begin(), relative.end(), '.', ' ');
+    long long amount = 0;
+    char unit[16] = {};
+    char ago[8] = {};
+    if (sscanf(relative.c_str(), "%lld %15s %7s", &amount, unit, ago) == 3 && string(ago) == "ago")
+    {
+        string u = unit;
+        if (u.size() > 1 && u.back() == 's')
+            u.pop_back();
+        static const map<string, int64_t> seconds = {{"second", 1},    {"minute", 60},      {"hour", 3600},
+                                                     {"day", 86400},   {"week", 604800},    {"month", 2592000},
+                                                     {"year", 31536000}};
+        auto it = seconds.find(u);
+        if (it != seconds.end())
+            return static_cast<int64_t>(now) - amount * it->second;
+    }
+    return fail(ErrorCode::InvalidArgument, "Invalid date: " + text);
+}
+
+bool isHexHash(const string &s)
+{
+    return s.size() == 2 * SHA_DIGEST_LENGTH &&
+           all_of(s.begin(), s.end(), [](char c) { return isxdigit(static_cast<unsigned char>(c)); });
+}
+
+string hashObject(const string &type, const string &content)
+{
+    return sha1Hex(type + " " + to_string(content.size()) + '\0' + content);
+}
+
+Result<string> readFile(const string &path)
+{
+    ifstream file(path, ios::binary);
+    if (!file.is_open())
+        return fail(ErrorCode::NotFound, "No such file or directory: " + path);
+
+    file.seekg(0, ios::end);
+    streamoff size = file.tellg();
+    file.seekg(0, ios::beg);
+    if (size < 0)
+        return fail(ErrorCode::IoError, "Failed to read " + path);
+
+    string content(static_cast<size_t>(size), '\0');
+    file.read(content.data(), size);
+    content.resize(static_cast<size_t>(file.gcount()));
+    if (file.bad())
+        return fail(ErrorCode::IoError, "Failed to read " + path);
+    return content;
+}
+
+namespace
+{
+
+void hexStringToBinary(const string &hexStr, unsigned char *binaryHash)
+{
+    for (size_t i = 0; i < SHA_DIGEST_LENGTH; ++i)
+    {
+        string byteString = hexStr.substr(i * 2, 2);
+        binaryHash[i] = (unsigned char)strtol(byteString.c_str(), nullptr, 16);
+    }
+}
+
+// write(2) until everything is out, false on any error but EINTR
+bool writeAll(int fd, const char *data, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t n = ::write(fd, data + written, size - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+// Inflates a whole zlib stream without guessing the output size up front.
+// With stopAt, inflating ends as soon as that marker has come out.
+bool inflateAll(const string &compressed, string &out, const string &stopAt = "")
+{
+    z_stream zs{};
+    if (inflateInit(&zs) != Z_OK)
+        return false;
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+    zs.avail_in = compressed.size();
+
+    out.clear();
+    char chunk[16384];
+    int result;
+    do
+    {
+        zs.next_out = reinterpret_cast<Bytef *>(chunk);
+        zs.avail_out = sizeof(chunk);
+        result = inflate(&zs, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END)
+        {
+            inflateEnd(&zs);
+            return false;
+        }
+        size_t searchFrom = out.size() >= stopAt.size() ? out.size() - stopAt.size() : 0;
+        out.append(chunk, sizeof(chunk) - zs.avail_out);
+        if (!stopAt.empty() && out.find(stopAt, searchFrom) != string::npos)
+            break;
+    } while (result != Z_STREAM_END);
+
+    inflateEnd(&zs);
+    return true;
+}
+
+// Pipelined blob hashing
+//
+// add and write-tree used to read one file at a time, so the CPU sat idle
+// while waiting on the disk. The read stage below keeps many reads in flight
+// (io_uring when available, a pool of reader threads otherwise) and feeds a
+// bounded queue that the SHA-1/deflate workers drain.
+
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // Blocks while the queue is full
+    void push(T item)
+    {
+        unique_lock<mutex> lock(m);
+        notFull.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+    }
+
+    // Returns false once the queue is closed and drained
+    bool pop(T &item)
+    {
+        unique_lock<mutex> lock(m);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    deque<T> items;
+    bool closed = false;
+    mutex m;
+    condition_variable notEmpty, notFull;
+};
+
+struct FileReadResult
+{
+    size_t index;
+    bool ok;
+    string content;
+};
+
+const size_t READ_QUEUE_DEPTH = 64;   // reads kept in flight by the I/O stage
+const size_t HASH_QUEUE_CAPACITY = 64; // files buffered between reading and hashing
+
+// Reads paths[i] for every i in indexes
+void readFilesThreaded(const vector<string> &paths, const vector<size_t> &indexes, BoundedQueue<FileReadResult> &out)
+{
+    // Reads mostly wait on the disk, so use more threads than CPUs
+    parallelFor(indexes.size(), [&](size_t i)
+    {
+        Result<string> content = readFile(paths[indexes[i]]);
+        out.push(FileReadResult{indexes[i], content.has_value(), content ? std::move(*content) : ""});
+    }, 16);
+}
+
+#ifdef MYGIT_HAVE_URING
+// Returns false if io_uring could not be set up, the caller then falls back to threads
+bool readFilesUring(const vector<string> &paths, BoundedQueue<FileReadResult> &out)
+{
+    struct io_uring ring;
+    if (io_uring_queue_init(READ_QUEUE_DEPTH, &ring, 0) < 0)
+        return false;
+
+    // IORING_OP_READ arrived in 5.6 together with probing, older rings reject every read
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+    bool canRead = probe && io_uring_opcode_supported(probe, IORING_OP_READ);
+    if (probe)
+        io_uring_free_probe(probe);
+    if (!canRead)
+    {
+        io_uring_queue_exit(&ring);
+        return false;
+    }
+
+    struct PendingRead
+    {
+        size_t index;
+        int fd;
+        size_t offset;
+        string content;
+    };
+
+    auto submitRead = [&ring](PendingRead *p)
+    {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_read(sqe, p->fd, p->content.data() + p->offset,
+                           p->content.size() - p->offset, p->offset);
+        io_uring_sqe_set_data(sqe, p);
+    };
+
+    auto finish = [&out](PendingRead *p, bool ok)
+    {
+        if (p->fd >= 0)
+            close(p->fd);
+        out.push(FileReadResult{p->index, ok, std::move(p->content)});
+        delete p;
+    };
+
+    size_t next = 0;
+    unordered_set<PendingRead *> inFlight;
+    bool broken = false;
+    while (next < paths.size() || !inFlight.empty())
+    {
+        // Top up the ring before waiting on a completion
+        while (next < paths.size() && inFlight.size() < READ_QUEUE_DEPTH)
+        {
+            PendingRead *p = new PendingRead{next++, -1, 0, ""};
+            struct stat st;
+            p->fd = open(paths[p->index].c_str(), O_RDONLY | O_CLOEXEC);
+            if (p->fd < 0 || fstat(p->fd, &st) < 0)
+            {
+                finish(p, false);
+                continue;
+            }
+            if (st.st_size == 0)
+            {
+                finish(p, true);
+                continue;
+            }
+            p->content.resize(static_cast<size_t>(st.st_size));
+            submitRead(p);
+            inFlight.insert(p);
+        }
+
+        int submitted = io_uring_submit(&ring);
+        if (submitted < 0 && submitted != -EINTR)
+        {
+            broken = true;
+            break;
+        }
+        if (inFlight.empty())
+            continue;
+
+        struct io_uring_cqe *cqe = nullptr;
+        int waited = io_uring_wait_cqe(&ring, &cqe);
+        if (waited == -EINTR)
+            continue;
+        if (waited < 0)
+        {
+            broken = true;
+            break;
+        }
+
+        PendingRead *p = static_cast<PendingRead *>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        if (res == -EINVAL)
+        {
+            // The ring turned the read down, a plain read can still get the file
+            Result<string> content = readFile(paths[p->index]);
+            p->content = content ? std::move(*content) : "";
+            inFlight.erase(p);
+            finish(p, content.has_value());
+        }
+        else if (res < 0)
+        {
+            inFlight.erase(p);
+            finish(p, false);
+        }
+        else if (res == 0 || p->offset + res >= p->content.size())
+        {
+            // A zero read means the file shrank under us, keep what we have
+            p->content.resize(p->offset + res);
+            inFlight.erase(p);
+            finish(p, true);
+        }
+        else
+        {
+            // Short read, resubmit for the remainder
+            p->offset += res;
+            submitRead(p);
+        }
+    }
+
+    io_uring_queue_exit(&ring);
+    if (broken)
+    {
+        // The ring stopped working, reader threads take over what it did not finish. Reads
+        // still in flight are left allocated since the kernel may yet write into them.
+        vector<size_t> remaining;
+        for (PendingRead *p : inFlight)
+        {
+            remaining.push_back(p->index);
+            close(p->fd);
+        }
+        for (; next < paths.size(); ++next)
+            remaining.push_back(next);
+        readFilesThreaded(paths, remaining, out);
+    }
+    return true;
+}
+#endif
+
+void readFilesPipelined(const vector<string> &paths, BoundedQueue<FileReadResult> &out)
+{
+#ifdef MYGIT_HAVE_URING
+    if (readFilesUring(paths, out))
+        return;
+#endif
+    vector<size_t> all(paths.size());
+    iota(all.begin(), all.end(), 0);
+    readFilesThreaded(paths, all, out);
+}
+
+void collectTreeFiles(const string &directoryPath, const string &prefix, vector<string> &files,
+                      vector<string> &relativePaths)
+{
+    for (const auto &entry : filesystem::directory_iterator(directoryPath))
+    {
+        if (entry.path().filename() == ".git")
+            continue;
+
+        string relative = prefix + entry.path().filename().string();
+        if (entry.is_directory())
+            collectTreeFiles(entry.path().string(), relative + "/", files, relativePaths);
+        else if (entry.is_regular_file())
+        {
+            files.push_back(entry.path().string());
+            relativePaths.push_back(relative);
+        }
+    }
+}
+
+struct TreeNode
+{
+    vector<TreeEntry> entries; // blobs and collapsed subtrees
+    map<string, TreeNode> children;
+};
+
+TreeNode &nodeFor(TreeNode &root, const string &dir)
+{
+    TreeNode *node = &root;
+    size_t start = 0;
+    while (start < dir.size())
+    {
+        size_t slash = dir.find('/', start);
+        if (slash == string::npos)
+            slash = dir.size();
+        node = &node->children[dir.substr(start, slash - start)];
+        start = slash + 1;
+    }
+    return *node;
+}
+
+Result<string> writeNode(const ObjectDatabase &objects, const TreeNode &node)
+{
+    vector<TreeEntry> entries = node.entries;
+    for (const auto &[name, child] : node.children)
+    {
+        Result<string> hash = writeNode(objects, child);
+        if (!hash)
+            return hash;
+        entries.push_back(TreeEntry{"40000", name, *hash});
+    }
+    return objects.writeTree(std::move(entries));
+}
+
+} // namespace
+
+// Object database
+
+ObjectDatabase::ObjectDatabase(const string &objectsDir)
+{
+    stores_.push_back(objectsDir);
+    loadAlternates(objectsDir, stores_);
+}
+
+// Follows objects/info/alternates, relative entries are relative to the objects directory
+void ObjectDatabase::loadAlternates(const string &objectsDir, vector<string> &stores, int depth)
+{
+    if (depth > 5)
+        return; // same nesting limit as git
+
+    ifstream alternatesFile(objectsDir + "/info/alternates");
+    string line;
+    while (getline(alternatesFile, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        filesystem::path path(line);
+        if (path.is_relative())
+            path = filesystem::path(objectsDir) / path;
+        string dir = path.lexically_normal().string();
+        if (!dir.empty() && dir.back() == '/')
+            dir.pop_back();
+
+        // Missing stores are skipped, lookups simply miss in them
+        if (std::find(stores.begin(), stores.end(), dir) != stores.end() || !filesystem::is_directory(dir))
+            continue;
+
+        stores.push_back(dir);
+        loadAlternates(dir, stores, depth + 1);
+    }
+}
+
+string ObjectDatabase::find(const string &hash) const
+{
+    if (!isHexHash(hash))
+        return "";
+
+    for (const string &dir : stores_)
+    {
+        string path = dir + "/" + hash.substr(0, 2) + "/" + hash.substr(2);
+        if (access(path.c_str(), F_OK) == 0)
+            return path;
+    }
+    return "";
+}
+
+Result<Object> ObjectDatabase::read(const string &hash) const
+{
+    string path = find(hash);
+    if (path.empty())
+        return fail(ErrorCode::NotFound, "Not a valid object name " + hash);
+
+    Result<string> compressed = readFile(path);
+    if (!compressed)
+        return std::unexpected(compressed.error());
+
+    string raw;
+    if (!inflateAll(*compressed, raw))
+        return fail(ErrorCode::CompressionError, "Failed to decompress object " + hash);
+
+    // need to split off the "<type> <size>\0" header
+    size_t spacePos = raw.find(' ');
+    size_t nullPos = raw.find('\0');
+    if (spacePos == string::npos || nullPos == string::npos || spacePos > nullPos)
+        return fail(ErrorCode::InvalidObject, "Invalid object format " + hash);
+
+    return Object{raw.substr(0, spacePos), raw.substr(nullPos + 1)};
+}
+
+Result<string> ObjectDatabase::type(const string &hash) const
+{
+    string path = find(hash);
+    if (path.empty())
+        return fail(ErrorCode::NotFound, "Not a valid object name " + hash);
+
+    Result<string> compressed = readFile(path);
+    if (!compressed)
+        return std::unexpected(compressed.error());
+
+    string raw;
+    if (!inflateAll(*compressed, raw, string(1, '\0')))
+        return fail(ErrorCode::CompressionError, "Failed to decompress object " + hash);
+
+    size_t spacePos = raw.find(' ');
+    if (spacePos == string::npos || raw.find('\0') < spacePos)
+        return fail(ErrorCode::InvalidObject, "Invalid object format " + hash);
+    return raw.substr(0, spacePos);
+}
+
+Result<string> ObjectDatabase::write(const string &type, const string &content) const
+{
+    string object = type + " " + to_string(content.size()) + '\0' + content;
+    string hashStr = sha1Hex(object);
+
+    // Objects are immutable, so a copy here or in an alternate store is as good as a new one,
+    // as long as it inflates: a torn file from an older mygit gets replaced below.
+    // Our own copy gets a fresh mtime so gc does not prune an object that was just written again.
+    string existing = find(hashStr);
+    if (!existing.empty())
+    {
+        Result<string> compressed = readFile(existing);
+        string raw;
+        if (compressed && inflateAll(*compressed, raw) && raw.size() == object.size())
+        {
+            if (existing.compare(0, directory().size() + 1, directory() + "/") == 0)
+                utime(existing.c_str(), nullptr);
+            return hashStr;
+        }
+    }
+
+    // create_directories instead of exists()+create_directory, hash workers may race on the same folder
+    string folderPath = directory() + "/" + hashStr.substr(0, 2);
+    error_code ec;
+    filesystem::create_directories(folderPath, ec);
+    if (ec)
+        return fail(ErrorCode::IoError, "Failed to create directory " + folderPath);
+
+    uLongf compressedSize = compressBound(object.size());
+    vector<unsigned char> compressedBuffer(compressedSize);
+
+    int result = compress(compressedBuffer.data(), &compressedSize,
+                          reinterpret_cast<const Bytef *>(object.data()), object.size());
+    if (result != Z_OK)
+        return fail(ErrorCode::CompressionError, "Failed to compress data. Result code: " + to_string(result));
+
+    // Hash workers can write the same object at once and readers or gc may look at any time,
+    // so the object only appears under its name once it is complete
+    string tmpPath = folderPath + "/tmp_obj_XXXXXX";
+    int fd = mkstemp(tmpPath.data());
+    if (fd < 0)
+        return fail(ErrorCode::IoError, "Failed to create object file for " + hashStr);
+    bool written = writeAll(fd, reinterpret_cast<const char *>(compressedBuffer.data()), compressedSize);
+    fchmod(fd, 0444); // objects never change
+    if (close(fd) != 0 || !written)
+    {
+        unlink(tmpPath.c_str());
+        return fail(ErrorCode::IoError, "Failed to write object file for " + hashStr);
+    }
+    if (rename(tmpPath.c_str(), (folderPath + "/" + hashStr.substr(2)).c_str()) != 0)
+    {
+        unlink(tmpPath.c_str());
+        return fail(ErrorCode::IoError, "Failed to write object file for " + hashStr);
+    }
+    return hashStr;
+}
+
+Result<vector<TreeEntry>> ObjectDatabase::readTree(const string &hash) const
+{
+    Result<Object> object = read(hash);
+    if (!object)
+        return std::unexpected(object.error());
+    if (object->type != "tree")
+        return fail(ErrorCode::InvalidObject, hash + " is not a tree");
+
+    const string &content = object->content;
+    vector<TreeEntry> entries;
+    size_t index = 0;
+    while (index < content.size())
+    {
+        size_t spacePos = content.find(' ', index);
+        size_t nullPos = content.find('\0', index);
+        if (spacePos == string::npos || nullPos == string::npos || spacePos > nullPos ||
+            nullPos + 1 + SHA_DIGEST_LENGTH > content.size())
+            return fail(ErrorCode::InvalidObject, "Unexpected end of data while reading tree " + hash);
+
+        TreeEntry entry;
+        entry.mode = content.substr(index, spacePos - index);
+        entry.name = content.substr(spacePos + 1, nullPos - spacePos - 1);
+
+        stringstream ss;
+        for (size_t i = nullPos + 1; i < nullPos + 1 + SHA_DIGEST_LENGTH; ++i)
+        {
+            ss << hex << setw(2) << setfill('0') << static_cast<unsigned int>(static_cast<unsigned char>(content[i]));
+        }
+        entry.hash = ss.str();
+
+        entries.push_back(std::move(entry));
+        index = nullPos + 1 + SHA_DIGEST_LENGTH;
+    }
+    return entries;
+}
+
+Result<Commit> ObjectDatabase::readCommit(const string &hash, unsigned fields) const
+{
+    string path = find(hash);
+    if (path.empty())
+        return fail(ErrorCode::NotFound, "Not a valid object name " + hash);
+
+    Result<string> compressed = readFile(path);
+    if (!compressed)
+        return std::unexpected(compressed.error());
+
+    // The header ends at the first blank line, skip inflating the message when nobody wants it
+    string raw;
+    if (!inflateAll(*compressed, raw, fields & CommitMessage ? "" : "\n\n"))
+        return fail(ErrorCode::CompressionError, "Failed to decompress object " + hash);
+
+    size_t nullPos = raw.find('\0');
+    if (raw.compare(0, 7, "commit ") != 0 || nullPos == string::npos)
+        return fail(ErrorCode::InvalidObject, hash + " is not a commit");
+
+    Commit commit;
+    commit.hash = hash;
+
+    size_t pos = nullPos + 1;
+    while (pos < raw.size())
+    {
+        size_t end = raw.find('\n', pos);
+        if (end == string::npos)
+            end = raw.size();
+        if (end == pos)
+        {
+            ++pos;
+            break; // blank line, the rest is the message
+        }
+
+        string_view line(raw.data() + pos, end - pos);
+        if (line.starts_with("parent "))
+            commit.parents.emplace_back(line.substr(7));
+        else if ((fields & CommitTree) && line.starts_with("tree "))
+            commit.tree = line.substr(5);
+        else if ((fields & CommitAuthor) && line.starts_with("author "))
+            commit.author = line.substr(7);
+        else if ((fields & CommitCommitter) && line.starts_with("committer "))
+            commit.committer = line.substr(10);
+        pos = end + 1;
+    }
+    if (fields & CommitMessage)
+    {
+        commit.message = raw.substr(min(pos, raw.size()));
+        if (!commit.message.empty() && commit.message.back() != '\n')
+            commit.message += '\n';
+    }
+
+    if ((fields & CommitTree) && !isHexHash(commit.tree))
+        return fail(ErrorCode::InvalidObject, "Invalid commit object format " + hash);
+    return commit;
+}
+
+Result<map<string, string>> ObjectDatabase::flattenTree(const string &treeHash) const
+{
+    map<string, string> files;
+
+    vector<pair<string, string>> pending{{treeHash, ""}};
+    while (!pending.empty())
+    {
+        auto [hash, prefix] = pending.back();
+        pending.pop_back();
+
+        Result<vector<TreeEntry>> entries = readTree(hash);
+        if (!entries)
+            return std::unexpected(entries.error());
+
+        for (const auto &entry : *entries)
+        {
+            if (entry.isTree())
+                pending.emplace_back(entry.hash, prefix + entry.name + "/");
+            else
+                files[prefix + entry.name] = entry.hash;
+        }
+    }
+    return files;
+}
+
+Result<vector<string>> ObjectDatabase::writeBlobs(const vector<string> &paths) const
+{
+    vector<string> hashes(paths.size());
+    if (paths.empty())
+        return hashes;
+
+    BoundedQueue<FileReadResult> queue(HASH_QUEUE_CAPACITY);
+
+    thread ioStage([&]
+    {
+        readFilesPipelined(paths, queue);
+        queue.close();
+    });
+
+    // First failure wins, workers keep draining so the I/O stage never blocks forever
+    mutex errorMutex;
+    optional<Error> firstError;
+
+    WorkerGroup workers(workerCount(paths.size()), [&]
+    {
+        FileReadResult res;
+        while (queue.pop(res))
+        {
+            Result<string> hash = res.ok ? write("blob", res.content)
+                                         : fail(ErrorCode::IoError, "Failed to read " + paths[res.index]);
+            if (hash)
+            {
+                hashes[res.index] = *hash;
+                continue;
+            }
+            lock_guard<mutex> lock(errorMutex);
+            if (!firstError)
+                firstError = hash.error();
+        }
+    });
+
+    ioStage.join();
+    workers.join();
+
+    if (firstError)
+        return std::unexpected(*firstError);
+    return hashes;
+}
+
+Result<string> ObjectDatabase::writeTree(const string &directory) const
+{
+    // Hash every blob up front so the read pipeline sees the whole tree at once, then build
+    // the trees from that same listing so files created meanwhile cannot get in the way
+    vector<string> files, relativePaths;
+    error_code ec;
+    if (!filesystem::is_directory(directory, ec))
+        return fail(ErrorCode::NotFound, "Not a directory: " + directory);
+    collectTreeFiles(directory, "", files, relativePaths);
+
+    Result<vector<string>> hashes = writeBlobs(files);
+    if (!hashes)
+        return std::unexpected(hashes.error());
+
+    TreeNode root;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        nodeFor(root, parentDir(relativePaths[i])).entries.push_back(
+            TreeEntry{"100644", baseName(relativePaths[i]), (*hashes)[i]});
+    }
+    return writeNode(*this, root);
+}
+
+Result<string> ObjectDatabase::writeTree(vector<TreeEntry> entries) const
+{
+    sort(entries.begin(), entries.end(), [](const TreeEntry &a, const TreeEntry &b)
+              { return a.name < b.name; });
+
+    string treeContent;
+    for (const auto &entry : entries)
+    {
+        treeContent += entry.mode + ' ' + entry.name;
+        treeContent.push_back('\0'); // Null terminator
+
+        unsigned char hash[SHA_DIGEST_LENGTH];
+        hexStringToBinary(entry.hash, hash);
+        treeContent.append(reinterpret_cast<const char *>(hash), SHA_DIGEST_LENGTH);
+    }
+
+    return write("tree", treeContent);
+}
+
+// Refs
+//
+// Refs live either as loose files under .git/refs or as lines in
+// .git/packed-refs ("<hash> <refname>", sorted by refname so lookups can
+// binary search). Everything is loaded at most once. Updates take "<file>.lock",
+// check the value on disk while holding it, and rename it into place, so readers
+// never see a half-written ref and writers never undo each other.
+
+bool isValidRefName(const string &name)
+{
+    if (name.empty() || name[0] == '-' || name[0] == '/' || name.back() == '/' || name.back() == '.')
+        return false;
+    if (name.find("..") != string::npos || name.find("//") != string::npos || name.find("@{") != string::npos)
+        return false;
+    if (name.size() >= 5 && name.compare(name.size() - 5, 5, ".lock") == 0)
+        return false;
+    for (char c : name)
+    {
+        if (static_cast<unsigned char>(c) <= ' ' || strchr("~^:?*[\\", c))
+            return false;
+    }
+    return true;
+}
+
+namespace
+{
+
+// "<path>.lock" taken by acquire() and held until commit() renames it over path, or
+// dropped when the object goes away. Whoever holds it owns path.
+class LockFile
+{
+public:
+    explicit LockFile(const string &path) : path_(path), lockPath_(path + ".lock") {}
+
+    ~LockFile()
+    {
+        if (fd_ >= 0)
+        {
+            close(fd_);
+            unlink(lockPath_.c_str());
+        }
+    }
+
+    Status acquire()
+    {
+        fd_ = open(lockPath_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+        {
+            ErrorCode code = errno == EEXIST ? ErrorCode::Locked : ErrorCode::IoError;
+            return fail(code, "Unable to create " + lockPath_ + ": " + strerror(errno));
+        }
+        return {};
+    }
+
+    Status commit(const string &data)
+    {
+        if (!writeAll(fd_, data.data(), data.size()))
+            return fail(ErrorCode::IoError, "Failed to write " + lockPath_);
+        close(fd_);
+        fd_ = -1;
+
+        if (rename(lockPath_.c_str(), path_.c_str()) != 0)
+        {
+            unlink(lockPath_.c_str());
+            return fail(ErrorCode::IoError, "Failed to rename " + lockPath_);
+        }
+        return {};
+    }
+
+private:
+    string path_;
+    string lockPath_;
+    int fd_ = -1;
+};
+
+} // namespace
+
+Status writeFileLocked(const string &path, const string &data)
+{
+    LockFile lock(path);
+    Status status = lock.acquire();
+    if (!status)
+        return status;
+    return lock.commit(data);
+}
+
+RefStore::RefStore(const string &gitDir) : gitDir_(gitDir)
+{
+}
+
+string RefStore::headRef()
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+    loadHead();
+    return headSymbolic_;
+}
+
+Result<string> RefStore::resolve(const string &name)
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+
+    string hash;
+    if (name == "HEAD")
+    {
+        loadHead();
+        hash = headSymbolic_.empty() ? headHash_ : lookup(headSymbolic_);
+    }
+    else if (name.rfind("refs/", 0) == 0)
+    {
+        hash = lookup(name);
+    }
+    else
+    {
+        hash = lookup("refs/heads/" + name);
+        if (hash.empty())
+            hash = lookup("refs/tags/" + name);
+        if (hash.empty() && isHexHash(name))
+            hash = name;
+    }
+
+    if (hash.empty())
+        return fail(ErrorCode::NotFound, "Not a valid ref: " + name);
+    return hash;
+}
+
+bool RefStore::exists(const string &refName)
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+    return !lookup(refName).empty();
+}
+
+Status RefStore::update(const string &refName, const string &hash, const optional<string> &expectedOld)
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+
+    string path = gitDir_ + "/" + refName;
+    error_code ec;
+    filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+    LockFile refLock(path);
+    Status status = refLock.acquire();
+    if (!status)
+        return status;
+
+    // Another process may have moved the ref since we last looked
+    if (expectedOld && lookupOnDisk(refName) != *expectedOld)
+        return fail(ErrorCode::Locked, refName + " was updated by someone else, try again");
+
+    status = refLock.commit(hash + "\n");
+    if (status)
+        loose_[refName] = hash;
+    return status;
+}
+
+Status RefStore::setHead(const string &target)
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+
+    string data = isHexHash(target) ? target + "\n" : "ref: " + target + "\n";
+    Status status = writeFileLocked(gitDir_ + "/HEAD", data);
+    headLoaded_ = false;
+    return status;
+}
+
+Status RefStore::updateHead(const string &hash, const optional<string> &expectedOld)
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+
+    headLoaded_ = false;
+    loadHead();
+    if (!headSymbolic_.empty())
+        return update(headSymbolic_, hash, expectedOld);
+
+    LockFile headLock(gitDir_ + "/HEAD");
+    Status status = headLock.acquire();
+    if (!status)
+        return status;
+    headLoaded_ = false;
+    loadHead();
+    if (expectedOld && (!headSymbolic_.empty() || headHash_ != *expectedOld))
+        return fail(ErrorCode::Locked, "HEAD was updated by someone else, try again");
+
+    status = headLock.commit(hash + "\n");
+    if (status)
+        headHash_ = hash;
+    return status;
+}
+
+Status RefStore::remove(const string &refName)
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+
+    // The ref's own lock keeps updates out, packed-refs.lock other rewrites of packed-refs
+    string path = gitDir_ + "/" + refName;
+    LockFile refLock(path);
+    Status status;
+    if (filesystem::is_directory(filesystem::path(path).parent_path()))
+        status = refLock.acquire(); // otherwise there is no loose ref to race with
+    if (!status)
+        return status;
+    LockFile packedLock(gitDir_ + "/packed-refs");
+    status = packedLock.acquire();
+    if (!status)
+        return status;
+
+    bool found = false;
+
+    // Edit what is on disk now, not what we loaded earlier
+    packedLoaded_ = false;
+    packed_.clear();
+    loadPacked();
+    auto it = findPacked(refName);
+    if (it != packed_.end())
+    {
+        packed_.erase(it);
+        status = packedLock.commit(packedData());
+        if (!status)
+            return status;
+        found = true;
+    }
+
+    if (filesystem::is_regular_file(path))
+    {
+        if (unlink(path.c_str()) != 0)
+            return fail(ErrorCode::IoError, "Failed to delete " + path);
+        found = true;
+    }
+    loose_[refName] = "";
+
+    if (!found)
+        return fail(ErrorCode::NotFound, refName + " not found");
+    return {};
+}
+
+vector<pair<string, string>> RefStore::list(const string &prefix)
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+
+    map<string, string> result;
+
+    loadPacked();
+    auto it = lower_bound(packed_.begin(), packed_.end(), prefix,
+                          [](const pair<string, string> &e, const string &key) { return e.first < key; });
+    for (; it != packed_.end() && it->first.rfind(prefix, 0) == 0; ++it)
+    {
+        result[it->first] = it->second;
+    }
+
+    string dir = gitDir_ + "/" + prefix;
+    if (filesystem::is_directory(dir))
+    {
+        for (const auto &entry : filesystem::recursive_directory_iterator(dir))
+        {
+            if (!entry.is_regular_file() || entry.path().extension() == ".lock")
+                continue;
+            string refName = prefix + filesystem::relative(entry.path(), dir).generic_string();
+            string hash = lookup(refName);
+            if (!hash.empty())
+                result[refName] = hash;
+        }
+    }
+
+    return vector<pair<string, string>>(result.begin(), result.end());
+}
+
+Status RefStore::packRefs()
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+
+    LockFile packedLock(gitDir_ + "/packed-refs");
+    Status status = packedLock.acquire();
+    if (!status)
+        return status;
+
+    // Start from what is on disk, other processes may have changed refs since we cached them
+    packedLoaded_ = false;
+    packed_.clear();
+    loose_.clear();
+    vector<pair<string, string>> all = list("refs/");
+
+    packed_ = all;
+    status = packedLock.commit(packedData());
+    if (!status)
+        return status;
+
+    // A loose ref is only dropped under its lock and while it still holds the packed value
+    for (const auto &ref : all)
+    {
+        string path = gitDir_ + "/" + ref.first;
+        loose_.erase(ref.first);
+        if (!filesystem::is_regular_file(path))
+            continue;
+        LockFile refLock(path);
+        if (!refLock.acquire())
+            continue; // being updated right now, it stays loose
+        string hash;
+        ifstream refFile(path);
+        getline(refFile, hash);
+        if (hash == ref.second)
+            unlink(path.c_str());
+    }
+    return {};
+}
+
+void RefStore::reload()
+{
+    lock_guard<recursive_mutex> lock(mutex_);
+    headLoaded_ = false;
+    packedLoaded_ = false;
+    packed_.clear();
+    loose_.clear();
+}
+
+void RefStore::loadHead()
+{
+    if (headLoaded_)
+        return;
+    headLoaded_ = true;
+    headSymbolic_.clear();
+    headHash_.clear();
+
+    ifstream headFile(gitDir_ + "/HEAD");
+    string line;
+    getline(headFile, line);
+    if (line.rfind("ref: ", 0) == 0)
+        headSymbolic_ = line.substr(5); // Skipping "ref: "
+    else
+        headHash_ = line;
+}
+
+void RefStore::loadPacked()
+{
+    if (packedLoaded_)
+        return;
+    packedLoaded_ = true;
+
+    ifstream packedFile(gitDir_ + "/packed-refs");
+    string line;
+    bool sorted = true;
+    while (getline(packedFile, line))
+    {
+        if (line.empty() || line[0] == '#' || line[0] == '^')
+            continue;
+        size_t spacePos = line.find(' ');
+        if (spacePos == string::npos)
+            continue;
+        packed_.emplace_back(line.substr(spacePos + 1), line.substr(0, spacePos));
+        if (packed_.size() > 1 && packed_[packed_.size() - 2].first > packed_.back().first)
+            sorted = false;
+    }
+
+    // We always write it sorted, only hand-edited files need this
+    if (!sorted)
+        sort(packed_.begin(), packed_.end());
+}
+
+vector<pair<string, string>>::iterator RefStore::findPacked(const string &refName)
+{
+    auto it = lower_bound(packed_.begin(), packed_.end(), refName,
+                          [](const pair<string, string> &e, const string &key) { return e.first < key; });
+    if (it != packed_.end() && it->first == refName)
+        return it;
+    return packed_.end();
+}
+
+string RefStore::packedData() const
+{
+    string data = "# pack-refs with: sorted\n";
+    for (const auto &ref : packed_)
+    {
+        data += ref.second + " " + ref.first + "\n";
+    }
+    return data;
+}
+
+string RefStore::lookup(const string &refName)
+{
+    auto cached = loose_.find(refName);
+    if (cached == loose_.end())
+    {
+        string hash;
+        ifstream refFile(gitDir_ + "/" + refName);
+        if (refFile.is_open())
+            getline(refFile, hash);
+        cached = loose_.emplace(refName, hash).first;
+    }
+    if (!cached->second.empty())
+        return cached->second;
+
+    loadPacked();
+    auto it = findPacked(refName);
+    return it != packed_.end() ? it->second : "";
+}
+
+// Bypasses (and refreshes) the caches, for checks made while holding a lock
+string RefStore::lookupOnDisk(const string &refName)
+{
+    loose_.erase(refName);
+    packedLoaded_ = false;
+    packed_.clear();
+    return lookup(refName);
+}
+
+// History
+
+RevWalk::RevWalk(const ObjectDatabase &objects, string start, unsigned fields, bool firstParent)
+    : objects_(objects), fields_(fields | CommitCommitter), firstParent_(firstParent), start_(std::move(start))
+{
+}
+
+Status RevWalk::push(const string &hash)
+{
+    if (!seen_.insert(hash).second)
+        return {};
+
+    Result<Commit> commit = objects_.readCommit(hash, fields_);
+    if (!commit)
+        return std::unexpected(commit.error());
+    int64_t time = commitTime(*commit);
+    queue_.push_back(Pending{time, pushed_++, std::move(*commit)});
+    push_heap(queue_.begin(), queue_.end());
+    return {};
+}
+
+Result<optional<Commit>> RevWalk::next()
+{
+    if (!start_.empty())
+    {
+        Status status = push(start_);
+        start_.clear();
+        if (!status)
+            return std::unexpected(status.error());
+    }
+    if (queue_.empty())
+        return optional<Commit>();
+
+    pop_heap(queue_.begin(), queue_.end());
+    Commit commit = std::move(queue_.back().commit);
+    queue_.pop_back();
+
+    // Parents are only read once their child has been handed out
+    for (const string &parent : commit.parents)
+    {
+        Status status = push(parent);
+        if (!status)
+            return std::unexpected(status.error());
+        if (firstParent_)
+            break;
+    }
+    return optional<Commit>(std::move(commit));
+}
+
+// Sparse checkout
+//
+// Cone mode, as in git: the listed directories are materialized recursively,
+// along with the files directly inside each of their ancestors (and the root).
+// Every other directory stays collapsed: the index keeps one "<tree> <dir>/"
+// entry for it and commit reuses that tree id without reading it.
+
+namespace
+{
+
+enum class ConeMatch
+{
+    Outside, // collapsed, never scanned
+    Parent,  // on the way to a cone directory, only its own files are included
+    Inside,
+};
+
+ConeMatch matchCone(const vector<string> &cone, const string &dir)
+{
+    if (cone.empty())
+        return ConeMatch::Inside;
+
+    for (const string &d : cone)
+    {
+        if (dir == d || (dir.size() > d.size() && dir.compare(0, d.size(), d) == 0 && dir[d.size()] == '/'))
+            return ConeMatch::Inside;
+    }
+    if (dir.empty())
+        return ConeMatch::Parent;
+    for (const string &d : cone)
+    {
+        if (d.size() > dir.size() && d.compare(0, dir.size(), dir) == 0 && d[dir.size()] == '/')
+            return ConeMatch::Parent;
+    }
+    return ConeMatch::Outside;
+}
+
+// Flattens the cone part of a tree. Directories outside the cone land in
+// collapsed ("dir/" -> tree hash) and are never read.
+Status flattenCone(const ObjectDatabase &objects, const string &treeHash, const vector<string> &cone,
+                   const string &prefix, map<string, string> &files, map<string, string> &collapsed)
+{
+    Result<vector<TreeEntry>> entries = objects.readTree(treeHash);
+    if (!entries)
+        return std::unexpected(entries.error());
+
+    for (const auto &entry : *entries)
+    {
+        string path = prefix + entry.name;
+        if (!entry.isTree())
+        {
+            files[path] = entry.hash;
+        }
+        else if (matchCone(cone, path) == ConeMatch::Outside)
+        {
+            collapsed[path + "/"] = entry.hash;
+        }
+        else
+        {
+            Status status = flattenCone(objects, entry.hash, cone, path + "/", files, collapsed);
+            if (!status)
+                return status;
+        }
+    }
+    return {};
+}
+
+// Work tree files (full paths) and their paths relative to the work tree, skipping collapsed directories
+void collectConeFiles(const string &workTree, const string &relative, const vector<string> &cone,
+                      vector<string> &files, vector<string> &relativePaths)
+{
+    string dir = relative.empty() ? workTree : workTree + "/" + relative;
+    for (const auto &entry : filesystem::directory_iterator(dir))
+    {
+        string name = entry.path().filename().string();
+        if (name == ".git")
+            continue;
+
+        string path = relative.empty() ? name : relative + "/" + name;
+        if (entry.is_directory())
+        {
+            if (matchCone(cone, path) != ConeMatch::Outside)
+                collectConeFiles(workTree, path, cone, files, relativePaths);
+        }
+        else if (entry.is_regular_file())
+        {
+            files.push_back(entry.path().string());
+            relativePaths.push_back(path);
+        }
+    }
+}
+
+// Snapshots the cone part of the work tree and splices the collapsed subtrees back in
+Result<string> writeSparseTree(const ObjectDatabase &objects, const string &workTree, const vector<string> &cone,
+                               const map<string, string> &collapsed)
+{
+    vector<string> files, relativePaths;
+    collectConeFiles(workTree, "", cone, files, relativePaths);
+
+    Result<vector<string>> hashes = objects.writeBlobs(files);
+    if (!hashes)
+        return std::unexpected(hashes.error());
+
+    TreeNode root;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        nodeFor(root, parentDir(relativePaths[i])).entries.push_back(
+            TreeEntry{"100644", baseName(relativePaths[i]), (*hashes)[i]});
+    }
+    for (const auto &[dir, hash] : collapsed)
+    {
+        string path = dir.substr(0, dir.size() - 1); // drop the trailing '/'
+        nodeFor(root, parentDir(path)).entries.push_back(TreeEntry{"40000", baseName(path), hash});
+    }
+    return writeNode(objects, root);
+}
+
+Result<string> normalizeConeDirectory(const string &dir)
+{
+    string normalized = filesystem::path(dir).lexically_normal().generic_string();
+    while (!normalized.empty() && normalized.back() == '/')
+        normalized.pop_back();
+
+    if (normalized.empty() || normalized == "." || normalized[0] == '/' || normalized.rfind("..", 0) == 0)
+        return fail(ErrorCode::InvalidArgument, "Not a directory inside the repository: " + dir);
+    return normalized;
+}
+
+} // namespace
+
+// Repository
+
+Repository::Repository(string workTree)
+    : workTree_(std::move(workTree)), gitDir_(workTree_ + "/.git"),
+      objects_(make_unique<ObjectDatabase>(gitDir_ + "/objects")),
+      refs_(make_unique<RefStore>(gitDir_)), commitGraph_(make_unique<CommitGraph>(*objects_))
+{
+    ifstream sparseFile(gitDir_ + "/info/sparse-checkout");
+    string line;
+    while (getline(sparseFile, line))
+    {
+        if (!line.empty() && line[0] != '#')
+            sparseCone_.push_back(line);
+    }
+}
+
+Result<unique_ptr<Repository>> Repository::open(const string &workTree)
+{
+    if (!filesystem::is_directory(workTree + "/.git/objects"))
+        return fail(ErrorCode::NotFound, workTree + " is not a mygit repository");
+    return unique_ptr<Repository>(new Repository(workTree));
+}
+
+Result<unique_ptr<Repository>> Repository::init(const string &workTree)
+{
+    string gitDir = workTree + "/.git";
+    try
+    {
+        filesystem::create_directories(gitDir + "/objects");
+        filesystem::create_directories(gitDir + "/refs/heads");
+    }
+    catch (const std::filesystem::filesystem_error &e)
+    {
+        return fail(ErrorCode::IoError, e.what());
+    }
+
+    ofstream headFile(gitDir + "/HEAD");
+    if (!headFile.is_open())
+        return fail(ErrorCode::IoError, "Failed to create .git/HEAD file.");
+    headFile << "ref: refs/heads/main\n";
+    headFile.close();
+
+    return unique_ptr<Repository>(new Repository(workTree));
+}
+
+string Repository::path(const string &relative) const
+{
+    return workTree_ == "." ? relative : workTree_ + "/" + relative;
+}
+
+Result<vector<IndexEntry>> Repository::readIndex() const
+{
+    vector<IndexEntry> entries;
+
+    ifstream indexFile(gitDir_ + "/index");
+    string line;
+    while (getline(indexFile, line))
+    {
+        if (line.empty())
+            continue;
+        size_t spacePos = line.find(' ');
+        if (spacePos != 2 * SHA_DIGEST_LENGTH)
+            return fail(ErrorCode::InvalidObject, "Corrupt index line: " + line);
+        entries.push_back(IndexEntry{line.substr(0, spacePos), line.substr(spacePos + 1)});
+    }
+    return entries;
+}
+
+// Collapsed directories from the sparse index, falling back to HEAD when the index has none
+Result<map<string, string>> Repository::collapsedDirectories()
+{
+    map<string, string> collapsed;
+
+    Result<vector<IndexEntry>> index = readIndex();
+    if (!index)
+        return std::unexpected(index.error());
+    for (const auto &entry : *index)
+    {
+        if (!entry.path.empty() && entry.path.back() == '/')
+            collapsed[entry.path] = entry.hash;
+    }
+    if (!collapsed.empty())
+        return collapsed;
+
+    Result<string> head = refs_->resolve("HEAD");
+    if (!head)
+        return collapsed; // nothing committed yet, nothing to collapse
+
+    Result<Commit> commit = objects_->readCommit(*head);
+    if (!commit)
+        return std::unexpected(commit.error());
+    map<string, string> files;
+    Status status = flattenCone(*objects_, commit->tree, sparseCone_, "", files, collapsed);
+    if (!status)
+        return std::unexpected(status.error());
+    return collapsed;
+}
+
+// Replaces the sparse directory entries of the index, optionally keeping staged files inside the cone
+Status Repository::rewriteIndex(const map<string, string> &collapsed, bool keepStaged)
+{
+    string data;
+    if (keepStaged)
+    {
+        Result<vector<IndexEntry>> index = readIndex();
+        if (!index)
+            return std::unexpected(index.error());
+        for (const auto &entry : *index)
+        {
+            if (entry.path.empty() || entry.path.back() == '/')
+                continue;
+            if (matchCone(sparseCone_, parentDir(entry.path)) != ConeMatch::Outside)
+                data += entry.hash + " " + entry.path + "\n";
+        }
+    }
+    for (const auto &[dir, hash] : collapsed)
+    {
+        data += hash + " " + dir + "\n";
+    }
+    return writeFileLocked(gitDir_ + "/index", data);
+}
+
+Result<vector<IndexEntry>> Repository::add(const vector<string> &paths)
+{
+    auto relativeTo = [this](const filesystem::path &p)
+    { return p.lexically_relative(workTree_).generic_string(); };
+
+    // Collect everything first so the read pipeline can keep many files in flight
+    vector<string> files;
+    for (const string &file : paths)
+    {
+        string fullPath = path(file);
+        if (filesystem::is_directory(fullPath))
+        {
+            string dir = relativeTo(fullPath);
+            if (matchCone(sparseCone_, dir == "." ? "" : dir) == ConeMatch::Outside)
+                return fail(ErrorCode::InvalidArgument, file + " is outside of the sparse-checkout cone.");
+
+            // Recursively adding files
+            for (auto it = filesystem::recursive_directory_iterator(fullPath); it != filesystem::recursive_directory_iterator(); ++it)
+            {
+                const auto &entry = *it;
+                if (entry.is_directory())
+                {
+                    // Exclude files inside .git directory and collapsed sparse directories
+                    if (entry.path().filename() == ".git" ||
+                        matchCone(sparseCone_, relativeTo(entry.path())) == ConeMatch::Outside)
+                        it.disable_recursion_pending();
+                    continue;
+                }
+                // Same rule as a file named on its own, or commit would drop it behind the collapsed entry
+                if (entry.is_regular_file() &&
+                    matchCone(sparseCone_, parentDir(relativeTo(entry.path()))) != ConeMatch::Outside)
+                    files.push_back(entry.path().string());
+            }
+        }
+        else if (filesystem::is_regular_file(fullPath))
+        {
+            if (matchCone(sparseCone_, parentDir(relativeTo(fullPath))) == ConeMatch::Outside)
+                return fail(ErrorCode::InvalidArgument, file + " is outside of the sparse-checkout cone.");
+            files.push_back(fullPath);
+        }
+        else
+        {
+            return fail(ErrorCode::NotFound, file + " is not a valid file or directory.");
+        }
+    }
+
+    Result<vector<string>> hashes = objects_->writeBlobs(files);
+    if (!hashes)
+        return std::unexpected(hashes.error());
+
+    ofstream indexFile(gitDir_ + "/index", ios::app);
+    if (!indexFile.is_open())
+        return fail(ErrorCode::IoError, "Could not open index file.");
+
+    vector<IndexEntry> entries;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        string relative = relativeTo(files[i]);
+        entries.push_back(IndexEntry{(*hashes)[i], relative});
+        indexFile << (*hashes)[i] << " " << relative << "\n";
+    }
+
+    indexFile.close();
+    if (indexFile.fail())
+        return fail(ErrorCode::IoError, "Failed to write index file.");
+    return entries;
+}
+
+Result<string> Repository::writeTree()
+{
+    if (sparseCone_.empty())
+        return objects_->writeTree(workTree_);
+
+    // Only the cone is scanned, collapsed directories keep their tree ids
+    Result<map<string, string>> collapsed = collapsedDirectories();
+    if (!collapsed)
+        return std::unexpected(collapsed.error());
+    return writeSparseTree(*objects_, workTree_, sparseCone_, *collapsed);
+}
+
+// Shared by commit and merge, every commit is authored and committed now
+Result<string> Repository::writeCommit(const string &tree, const vector<string> &parents, const string &message)
+{
+    time_t now = time(nullptr);
+    char timeStr[100];
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S %z", localtime(&now));
+
+    string commitContent;
+    commitContent += "tree " + tree + "\n";
+    for (const string &parent : parents)
+        commitContent += "parent " + parent + "\n";
+    commitContent += "author : <VaibhavGupta@gmail.com> " + string(timeStr) + "\n";
+    commitContent += "committer : <VaibhavGupta@gmail.com> " + string(timeStr) + "\n\n";
+    commitContent += message + "\n";
+    Result<string> commitHash = objects_->write("commit", commitContent);
+    if (!commitHash)
+        return commitHash;
+
+    // The parents are at hand, so merge-base never has to walk back to this commit.
+    // The graph is only a cache, a failed append is recomputed on lookup.
+    commitGraph_->add(*commitHash, parents, static_cast<int64_t>(now));
+    return commitHash;
+}
+
+Result<string> Repository::commit(const string &message)
+{
+    if (!filesystem::exists(gitDir_ + "/index"))
+        return fail(ErrorCode::NotFound, "No changes added to commit.");
+
+    Result<string> treeHash = writeTree();
+    if (!treeHash)
+        return treeHash;
+
+    // parent commit SHA
+    vector<string> parents;
+    Result<string> parentHash = refs_->resolve("HEAD");
+    if (parentHash)
+        parents.push_back(*parentHash);
+
+    // Concluding a merge that stopped on conflicts
+    Result<string> mergeHead = readFile(gitDir_ + "/MERGE_HEAD");
+    if (mergeHead)
+    {
+        string mergeHash = mergeHead->substr(0, mergeHead->find('\n'));
+        if (!isHexHash(mergeHash))
+            return fail(ErrorCode::InvalidObject, "Corrupt .git/MERGE_HEAD");
+        parents.push_back(mergeHash);
+    }
+
+    Result<string> commitHash = writeCommit(*treeHash, parents, message);
+    if (!commitHash)
+        return commitHash;
+
+    // Update the HEAD reference, unless another commit got there first
+    Status status = refs_->updateHead(*commitHash, parentHash ? *parentHash : "");
+    if (!status)
+        return std::unexpected(status.error());
+    if (mergeHead)
+        unlink((gitDir_ + "/MERGE_HEAD").c_str());
+
+    //  Now Clearing the index file, a sparse index keeps its collapsed directories
+    if (!sparseCone_.empty())
+    {
+        Result<map<string, string>> collapsed = collapsedDirectories();
+        status = collapsed ? rewriteIndex(*collapsed, false) : std::unexpected(collapsed.error());
+        if (!status)
+            return std::unexpected(status.error());
+    }
+    else
+    {
+        ofstream indexFileOut(gitDir_ + "/index", ofstream::trunc);
+        indexFileOut.close();
+    }
+
+    return commitHash;
+}
+
+Status Repository::applyWorkTreeChange(const map<string, string> &oldFiles, const map<string, string> &newFiles)
+{
+    vector<string> toRemove, toWrite;
+    for (const auto &file : oldFiles)
+    {
+        if (!newFiles.count(file.first))
+            toRemove.push_back(file.first);
+    }
+    for (const auto &file : newFiles)
+    {
+        auto old = oldFiles.find(file.first);
+        if (old == oldFiles.end() || old->second != file.second || !filesystem::exists(path(file.first)))
+            toWrite.push_back(file.first);
+    }
+
+    // Everything we are about to touch must still match what the old commit had
+    string dirty;
+    auto checkClean = [&](const string &file)
+    {
+        Result<string> content = readFile(path(file));
+        if (!content)
+            return;
+        auto old = oldFiles.find(file);
+        auto next = newFiles.find(file);
+        string current = hashObject("blob", *content);
+        if ((old == oldFiles.end() || old->second != current) &&
+            (next == newFiles.end() || next->second != current))
+            dirty += (dirty.empty() ? "" : ", ") + file;
+    };
+    for_each(toRemove.begin(), toRemove.end(), checkClean);
+    for_each(toWrite.begin(), toWrite.end(), checkClean);
+    if (!dirty.empty())
+        return fail(ErrorCode::LocalChanges, "Your local changes would be overwritten: " + dirty);
+
+    for (const string &file : toRemove)
+    {
+        error_code ec;
+        filesystem::remove(path(file), ec);
+
+        // Drop directories the removal left empty
+        filesystem::path dir = filesystem::path(file).parent_path();
+        while (!dir.empty() && filesystem::is_empty(path(dir.string()), ec) && !ec)
+        {
+            filesystem::remove(path(dir.string()), ec);
+            dir = dir.parent_path();
+        }
+    }
+
+    for (const string &file : toWrite)
+    {
+        Result<Object> blob = objects_->read(newFiles.at(file));
+        if (!blob)
+            return std::unexpected(blob.error());
+
+        filesystem::path parent = filesystem::path(path(file)).parent_path();
+        if (!parent.empty())
+            filesystem::create_directories(parent);
+
+        ofstream outFile(path(file), ios::binary | ios::trunc);
+        if (!outFile.is_open())
+            return fail(ErrorCode::IoError, "Failed to write " + file);
+        outFile.write(blob->content.data(), static_cast<std::streamsize>(blob->content.size()));
+    }
+    return {};
+}
+
+Status Repository::updateWorkTree(const string &fromCommit, const string &toCommit)
+{
+    string fromTree;
+    if (!fromCommit.empty())
+    {
+        Result<Commit> commit = objects_->readCommit(fromCommit);
+        if (!commit)
+            return std::unexpected(commit.error());
+        fromTree = commit->tree;
+    }
+
+    Result<Commit> target = objects_->readCommit(toCommit);
+    if (!target)
+        return std::unexpected(target.error());
+    return switchTree(fromTree, target->tree);
+}
+
+Status Repository::switchTree(const string &fromTree, const string &toTree)
+{
+    // With a sparse cone only its part of either tree is read or materialized
+    map<string, string> oldFiles, newFiles, oldCollapsed, newCollapsed;
+    if (!fromTree.empty())
+    {
+        Status status = flattenCone(*objects_, fromTree, sparseCone_, "", oldFiles, oldCollapsed);
+        if (!status)
+            return status;
+    }
+
+    Status status = flattenCone(*objects_, toTree, sparseCone_, "", newFiles, newCollapsed);
+    if (!status)
+        return status;
+
+    status = applyWorkTreeChange(oldFiles, newFiles);
+    if (!status || sparseCone_.empty())
+        return status;
+    return rewriteIndex(newCollapsed, true);
+}
+
+Status Repository::setSparseCheckout(const vector<string> &directories)
+{
+    vector<string> cone;
+    for (const string &dir : directories)
+    {
+        Result<string> normalized = normalizeConeDirectory(dir);
+        if (!normalized)
+            return std::unexpected(normalized.error());
+        cone.push_back(*normalized);
+    }
+    if (cone.empty())
+        return fail(ErrorCode::InvalidArgument, "No sparse-checkout directories given");
+    sort(cone.begin(), cone.end());
+    cone.erase(unique(cone.begin(), cone.end()), cone.end());
+
+    // Move the work tree from the old cone (or everything) to the new one
+    map<string, string> collapsed;
+    Result<string> head = refs_->resolve("HEAD");
+    if (head)
+    {
+        Result<Commit> commit = objects_->readCommit(*head);
+        if (!commit)
+            return std::unexpected(commit.error());
+
+        map<string, string> oldFiles, newFiles, oldCollapsed;
+        Status status = flattenCone(*objects_, commit->tree, sparseCone_, "", oldFiles, oldCollapsed);
+        if (status)
+            status = flattenCone(*objects_, commit->tree, cone, "", newFiles, collapsed);
+        if (status)
+            status = applyWorkTreeChange(oldFiles, newFiles);
+        if (!status)
+            return status;
+    }
+
+    string data;
+    for (const string &dir : cone)
+    {
+        data += dir + "\n";
+    }
+    error_code ec;
+    filesystem::create_directories(gitDir_ + "/info", ec);
+    Status status = writeFileLocked(gitDir_ + "/info/sparse-checkout", data);
+    if (!status)
+        return status;
+
+    sparseCone_ = cone;
+    return rewriteIndex(collapsed, true);
+}
+
+Status Repository::disableSparseCheckout()
+{
+    if (sparseCone_.empty())
+        return {};
+
+    Result<string> head = refs_->resolve("HEAD");
+    if (head)
+    {
+        Result<Commit> commit = objects_->readCommit(*head);
+        if (!commit)
+            return std::unexpected(commit.error());
+
+        map<string, string> oldFiles, newFiles, collapsed;
+        Status status = flattenCone(*objects_, commit->tree, sparseCone_, "", oldFiles, collapsed);
+        if (status)
+            status = flattenCone(*objects_, commit->tree, {}, "", newFiles, collapsed);
+        if (status)
+            status = applyWorkTreeChange(oldFiles, newFiles);
+        if (!status)
+            return status;
+    }
+
+    if (unlink((gitDir_ + "/info/sparse-checkout").c_str()) != 0 && errno != ENOENT)
+        return fail(ErrorCode::IoError, "Failed to remove .git/info/sparse-checkout");
+
+    sparseCone_.clear();
+    return rewriteIndex({}, true);
+}
+
+Result<CheckoutResult> Repository::checkout(const string &target)
+{
+    // A branch name switches branches, anything else detaches HEAD
+    CheckoutResult result;
+    if (refs_->exists("refs/heads/" + target))
+        result.branch = "refs/heads/" + target;
+
+    Result<string> commitHash = refs_->resolve(target);
+    if (!commitHash || !objects_->readCommit(*commitHash))
+        return fail(ErrorCode::NotFound, "Not a valid branch or commit: " + target);
+    result.commit = *commitHash;
+
+    Status status = updateWorkTree(refs_->resolve("HEAD").value_or(""), result.commit);
+    if (!status)
+        return std::unexpected(status.error());
+
+    status = refs_->setHead(result.branch.empty() ? result.commit : result.branch);
+    if (!status)
+        return std::unexpected(status.error());
+    return result;
+}
+
+Result<MergeResult> Repository::merge(const string &target)
+{
+    if (filesystem::exists(gitDir_ + "/MERGE_HEAD"))
+        return fail(ErrorCode::LocalChanges, "A merge is in progress, commit it first.");
+
+    Result<string> theirs = refs_->resolve(target);
+    Result<Commit> theirCommit = theirs ? objects_->readCommit(*theirs) : std::unexpected(theirs.error());
+    if (!theirCommit)
+        return fail(ErrorCode::NotFound, "Not a valid branch or commit: " + target);
+
+    MergeResult result;
+    Result<string> ours = refs_->resolve("HEAD");
+    if (!ours)
+    {
+        // Nothing committed yet, just take theirs
+        Status status = updateWorkTree("", *theirs);
+        if (status)
+            status = refs_->updateHead(*theirs, "");
+        if (!status)
+            return std::unexpected(status.error());
+        result.commit = *theirs;
+        result.fastForward = true;
+        return result;
+    }
+
+    Result<vector<string>> bases = mergeBases(*commitGraph_, *ours, *theirs);
+    if (!bases)
+        return std::unexpected(bases.error());
+
+    if (find(bases->begin(), bases->end(), *theirs) != bases->end())
+    {
+        result.commit = *ours;
+        result.upToDate = true;
+        return result;
+    }
+    if (find(bases->begin(), bases->end(), *ours) != bases->end())
+    {
+        Status status = updateWorkTree(*ours, *theirs);
+        if (status)
+            status = refs_->updateHead(*theirs, *ours);
+        if (!status)
+            return std::unexpected(status.error());
+        result.commit = *theirs;
+        result.fastForward = true;
+        return result;
+    }
+
+    // With several best bases (criss-cross), merge against the first one
+    string baseTree;
+    if (!bases->empty())
+    {
+        Result<Commit> base = objects_->readCommit(bases->front());
+        if (!base)
+            return std::unexpected(base.error());
+        baseTree = base->tree;
+    }
+    Result<Commit> ourCommit = objects_->readCommit(*ours);
+    if (!ourCommit)
+        return std::unexpected(ourCommit.error());
+
+    Result<TreeMerge> merged = mergeTrees(*objects_, baseTree, ourCommit->tree, theirCommit->tree, "HEAD", target);
+    if (!merged)
+        return std::unexpected(merged.error());
+    result.conflicts = merged->conflicts;
+
+    for (const string &conflict : result.conflicts)
+    {
+        if (matchCone(sparseCone_, parentDir(conflict)) == ConeMatch::Outside)
+            return fail(ErrorCode::InvalidArgument, "Merge conflict in " + conflict +
+                                                        " outside of the sparse-checkout cone.");
+    }
+
+    Status status = switchTree(ourCommit->tree, merged->tree);
+    if (!status)
+        return std::unexpected(status.error());
+
+    if (!result.conflicts.empty())
+    {
+        // The work tree has the markers, the next commit picks up MERGE_HEAD
+        status = writeFileLocked(gitDir_ + "/MERGE_HEAD", *theirs + "\n");
+        if (!status)
+            return std::unexpected(status.error());
+        return result;
+    }
+
+    string message = (refs_->exists("refs/heads/" + target) ? "Merge branch '" : "Merge commit '") + target + "'";
+    Result<string> commitHash = writeCommit(merged->tree, {*ours, *theirs}, message);
+    if (!commitHash)
+        return std::unexpected(commitHash.error());
+    status = refs_->updateHead(*commitHash, *ours);
+    if (!status)
+        return std::unexpected(status.error());
+    result.commit = *commitHash;
+    return result;
+}
+
+// Clone
+
+namespace
+{
+
+// Hardlinks every object file (loose fan-out directories and packs) from one store into another.
+// Objects are immutable, so sharing the inode is safe. Falls back to copying across filesystems.
+Status linkObjects(const filesystem::path &srcObjects, const filesystem::path &dstObjects, CloneResult &result)
+{
+    bool canLink = true;
+
+    error_code dirError;
+    for (filesystem::directory_iterator dirs(srcObjects, dirError), end; !dirError && dirs != end;
+         dirs.increment(dirError))
+    {
+        const filesystem::directory_entry &dirEntry = *dirs;
+        string dirName = dirEntry.path().filename().string();
+        bool fanout = dirName.size() == 2 && isxdigit(static_cast<unsigned char>(dirName[0])) &&
+                      isxdigit(static_cast<unsigned char>(dirName[1]));
+        error_code ec;
+        if (!dirEntry.is_directory(ec) || (!fanout && dirName != "pack"))
+            continue; // info/ is per repository
+
+        filesystem::create_directories(dstObjects / dirName, ec);
+        if (ec)
+            return fail(ErrorCode::IoError, "Failed to create " + (dstObjects / dirName).string() + ": " + ec.message());
+
+        error_code fileError;
+        for (filesystem::directory_iterator files(dirEntry.path(), fileError); !fileError && files != end;
+             files.increment(fileError))
+        {
+            const filesystem::directory_entry &entry = *files;
+            if (!entry.is_regular_file(ec))
+                continue; // tmp objects vanish as their writer renames them
+
+            filesystem::path target = dstObjects / dirName / entry.path().filename();
+            if (canLink)
+            {
+                filesystem::create_hard_link(entry.path(), target, ec);
+                if (!ec || ec == errc::file_exists)
+                {
+                    ++result.linked;
+                    continue;
+                }
+                if (ec != errc::cross_device_link && ec != errc::operation_not_permitted)
+                    return fail(ErrorCode::IoError, "Failed to link " + entry.path().string() + ": " + ec.message());
+                canLink = false; // different filesystem, copy from here on
+            }
+
+            filesystem::copy_file(entry.path(), target, filesystem::copy_options::skip_existing, ec);
+            if (ec)
+                return fail(ErrorCode::IoError, "Failed to copy " + entry.path().string() + ": " + ec.message());
+            ++result.copied;
+        }
+        if (fileError)
+            return fail(ErrorCode::IoError, "Failed to read " + dirEntry.path().string() + ": " + fileError.message());
+    }
+    if (dirError)
+        return fail(ErrorCode::IoError, "Failed to read " + srcObjects.string() + ": " + dirError.message());
+    return {};
+}
+
+} // namespace
+
+Result<CloneResult> clone(const string &source, const string &destination, bool shared)
+{
+    error_code ec;
+    filesystem::path srcGit = filesystem::absolute(filesystem::path(source) / ".git", ec);
+    if (ec || !filesystem::is_directory(srcGit / "objects", ec))
+        return fail(ErrorCode::NotFound, source + " does not appear to be a mygit repository.");
+
+    if (filesystem::exists(destination, ec) && !filesystem::is_empty(destination, ec))
+        return fail(ErrorCode::AlreadyExists,
+                    "Destination path '" + destination + "' already exists and is not an empty directory.");
+
+    CloneResult result;
+    filesystem::path dstGit = filesystem::path(destination) / ".git";
+    filesystem::create_directories(dstGit / "objects" / "info", ec);
+    if (!ec)
+        filesystem::create_directories(dstGit / "refs" / "heads", ec);
+    if (ec)
+        return fail(ErrorCode::IoError, "Failed to create " + dstGit.string() + ": " + ec.message());
+
+    // Alternates of the source must stay reachable from the clone
+    string alternates;
+    {
+        vector<string> sourceStores{(srcGit / "objects").string()};
+        ObjectDatabase::loadAlternates(sourceStores[0], sourceStores);
+        for (size_t i = shared ? 0 : 1; i < sourceStores.size(); ++i)
+        {
+            alternates += sourceStores[i] + "\n";
+        }
+    }
+    if (!alternates.empty())
+    {
+        ofstream alternatesFile(dstGit / "objects" / "info" / "alternates");
+        alternatesFile << alternates;
+        alternatesFile.close();
+        if (alternatesFile.fail())
+            return fail(ErrorCode::IoError, "Failed to write " + (dstGit / "objects" / "info" / "alternates").string());
+    }
+
+    // Refs before objects: the source's store only grows, so everything the copied refs
+    // point at is still there when the objects are linked. Loose refs go before
+    // packed-refs, a concurrent pack-refs writes packed-refs before dropping loose files.
+    auto refOptions = filesystem::copy_options::recursive | filesystem::copy_options::overwrite_existing;
+    filesystem::copy(srcGit / "refs", dstGit / "refs", refOptions, ec);
+    if (ec)
+        return fail(ErrorCode::IoError, "Failed to copy " + (srcGit / "refs").string() + ": " + ec.message());
+    filesystem::copy_file(srcGit / "packed-refs", dstGit / "packed-refs", ec);
+    if (ec && ec != errc::no_such_file_or_directory)
+        return fail(ErrorCode::IoError, "Failed to copy " + (srcGit / "packed-refs").string() + ": " + ec.message());
+    filesystem::copy_file(srcGit / "HEAD", dstGit / "HEAD", ec);
+    if (ec)
+        return fail(ErrorCode::IoError, "Failed to copy " + (srcGit / "HEAD").string() + ": " + ec.message());
+
+    vector<filesystem::path> staleLocks;
+    for (filesystem::recursive_directory_iterator it(dstGit / "refs", ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (it->path().extension() == ".lock")
+            staleLocks.push_back(it->path()); // a writer was mid-update in the source
+    }
+    for (const auto &lock : staleLocks)
+        filesystem::remove(lock, ec);
+
+    if (!shared)
+    {
+        Status status = linkObjects(srcGit / "objects", dstGit / "objects", result);
+        if (!status)
+            return std::unexpected(status.error());
+    }
+
+    Result<unique_ptr<Repository>> repo = Repository::open(destination);
+    if (!repo)
+        return std::unexpected(repo.error());
+
+    Result<string> headHash = (*repo)->refs().resolve("HEAD");
+    if (headHash)
+    {
+        Status status = (*repo)->updateWorkTree("", *headHash);
+        if (!status)
+            return std::unexpected(status.error());
+    }
+    return result;
+}
+
+} // namespace mygit
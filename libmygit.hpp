@@ -0,0 +1,505 @@
+// libmygit - the object store, refs and history code behind the mygit CLI.
+//
+// Nothing in here prints. Every fallible call returns a Result<T> (or Status)
+// carrying an ErrorCode and a human readable message, so long-running services
+// can keep a Repository open and reuse its caches instead of spawning mygit.
+
+#ifndef LIBMYGIT_HPP
+#define LIBMYGIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace mygit
+{
+
+// Errors
+
+enum class ErrorCode
+{
+    Ok = 0,
+    NotFound,         // object, ref or file does not exist
+    InvalidObject,    // object is corrupt or not of the expected type
+    InvalidArgument,  // malformed ref name, hash, path, ...
+    AlreadyExists,
+    Locked,           // another writer holds the .lock file
+    LocalChanges,     // operation would overwrite uncommitted work
+    IoError,
+    CompressionError,
+};
+
+struct Error
+{
+    ErrorCode code;
+    std::string message;
+};
+
+template <typename T>
+using Result = std::expected<T, Error>;
+using Status = std::expected<void, Error>;
+
+inline std::unexpected<Error> fail(ErrorCode code, std::string message)
+{
+    return std::unexpected<Error>(Error{code, std::move(message)});
+}
+
+// Objects
+
+struct Object
+{
+    std::string type; // "blob", "tree" or "commit"
+    std::string content;
+};
+
+struct TreeEntry
+{
+    std::string mode;
+    std::string name;
+    std::string hash; // hex
+
+    bool isTree() const { return mode == "40000"; }
+};
+
+struct Commit
+{
+    std::string hash;
+    std::string tree;
+    std::vector<std::string> parents;
+    std::string author;
+    std::string committer;
+    std::string message;
+};
+
+// Parts of a commit readCommit should parse; the hash and parents are always filled in
+enum CommitField : unsigned
+{
+    CommitTree = 1,
+    CommitAuthor = 2,
+    CommitCommitter = 4,
+    CommitMessage = 8,
+    CommitAllFields = 15,
+};
+
+// Seconds since the epoch from the committer line, 0 if it cannot be parsed
+std::int64_t commitTime(const Commit &commit);
+
+// "now", "@<epoch>", "YYYY-MM-DD[ HH:MM[:SS]]" (local time) or "<n> <unit>s ago" / "<n>.<unit>s.ago"
+Result<std::int64_t> parseDate(const std::string &text);
+
+std::string sha1Hex(const std::string &data);
+bool isHexHash(const std::string &s);
+
+// Hash of "<type> <size>\0<content>", without storing anything
+std::string hashObject(const std::string &type, const std::string &content);
+
+Result<std::string> readFile(const std::string &path);
+
+// Loose object store plus any objects/info/alternates it points at.
+// All members are const and safe to call from several threads.
+class ObjectDatabase
+{
+public:
+    explicit ObjectDatabase(const std::string &objectsDir);
+
+    const std::string &directory() const { return stores_.front(); }
+
+    // This store followed by every alternate, in lookup order
+    const std::vector<std::string> &stores() const { return stores_; }
+
+    // Path of the object in the first store that has it, "" if none does
+    std::string find(const std::string &hash) const;
+    bool contains(const std::string &hash) const { return !find(hash).empty(); }
+
+    Result<Object> read(const std::string &hash) const;
+
+    // "blob", "tree" or "commit" from the object header, without inflating the whole object
+    Result<std::string> type(const std::string &hash) const;
+    Result<std::string> write(const std::string &type, const std::string &content) const;
+
+    Result<std::vector<TreeEntry>> readTree(const std::string &hash) const;
+    // Without CommitMessage only the header is inflated
+    Result<Commit> readCommit(const std::string &hash, unsigned fields = CommitAllFields) const;
+
+    // Every blob path under a tree mapped to its hash
+    Result<std::map<std::string, std::string>> flattenTree(const std::string &treeHash) const;
+
+    // Stores a blob for each file, keeping many reads in flight. Hashes come back in input order.
+    Result<std::vector<std::string>> writeBlobs(const std::vector<std::string> &paths) const;
+
+    // Writes blobs and trees for a directory (skipping .git) and returns the root tree hash
+    Result<std::string> writeTree(const std::string &directory) const;
+
+    // Writes a single tree object; entries are sorted by name first
+    Result<std::string> writeTree(std::vector<TreeEntry> entries) const;
+
+    // Reads objects/info/alternates of a store, following nested alternates
+    static void loadAlternates(const std::string &objectsDir, std::vector<std::string> &stores, int depth = 0);
+
+private:
+    std::vector<std::string> stores_;
+};
+
+// Refs
+
+// HEAD, loose refs and packed-refs, each loaded at most once and cached.
+// Updates hold "<file>.lock" while they re-read what is on disk, then rename
+// it into place, so other processes' changes are never overwritten. Safe to
+// share between threads.
+class RefStore
+{
+public:
+    explicit RefStore(const std::string &gitDir);
+
+    // Symbolic target of HEAD ("refs/heads/main"), or "" when HEAD is detached
+    std::string headRef();
+
+    // Accepts HEAD, full ref names, short branch/tag names and raw hashes
+    Result<std::string> resolve(const std::string &name);
+
+    bool exists(const std::string &refName);
+
+    // All refs under a prefix ("refs/heads/") sorted by name, loose entries shadow packed ones
+    std::vector<std::pair<std::string, std::string>> list(const std::string &prefix);
+
+    // With expectedOld the ref only moves if it still holds that value ("" = must not
+    // exist yet), otherwise the update fails with Locked
+    Status update(const std::string &refName, const std::string &hash,
+                  const std::optional<std::string> &expectedOld = std::nullopt);
+    Status remove(const std::string &refName);
+
+    // Points HEAD at a branch (symbolic) or, for a raw hash, detaches it
+    Status setHead(const std::string &target);
+
+    // Moves whatever HEAD points at to a new commit, expectedOld as for update()
+    Status updateHead(const std::string &hash, const std::optional<std::string> &expectedOld = std::nullopt);
+
+    // Moves every loose ref into packed-refs
+    Status packRefs();
+
+    // Drops the caches, for callers that outlive changes made by other processes
+    void reload();
+
+private:
+    void loadHead();
+    void loadPacked();
+    std::vector<std::pair<std::string, std::string>>::iterator findPacked(const std::string &refName);
+    std::string packedData() const;
+    std::string lookup(const std::string &refName);
+    std::string lookupOnDisk(const std::string &refName);
+
+    std::string gitDir_;
+    std::recursive_mutex mutex_;
+
+    bool headLoaded_ = false;
+    std::string headSymbolic_;
+    std::string headHash_;
+
+    bool packedLoaded_ = false;
+    std::vector<std::pair<std::string, std::string>> packed_; // (refname, hash) sorted by refname
+
+    std::unordered_map<std::string, std::string> loose_; // "" caches a missing loose file
+};
+
+bool isValidRefName(const std::string &name);
+
+// Writes a file through "<path>.lock" and renames it into place
+Status writeFileLocked(const std::string &path, const std::string &data);
+
+// History
+
+// Walks history from a commit, newest committer date first, parsing each commit only
+// when it is about to be returned (and only the requested fields). Stopping early
+// leaves the rest of history untouched.
+class RevWalk
+{
+public:
+    RevWalk(const ObjectDatabase &objects, std::string start, unsigned fields = CommitAllFields,
+            bool firstParent = false);
+
+    // The next commit, or std::nullopt once every ancestor has been returned
+    Result<std::optional<Commit>> next();
+
+private:
+    struct Pending
+    {
+        std::int64_t time;
+        std::uint64_t order; // insertion order breaks ties
+        Commit commit;
+
+        bool operator<(const Pending &other) const
+        {
+            return time != other.time ? time < other.time : order > other.order;
+        }
+    };
+
+    Status push(const std::string &hash);
+
+    const ObjectDatabase &objects_;
+    unsigned fields_;
+    bool firstParent_;
+    std::string start_;
+    std::uint64_t pushed_ = 0;
+    std::vector<Pending> queue_; // heap
+    std::unordered_set<std::string> seen_;
+};
+
+// Grep
+
+struct GrepOptions
+{
+    std::string pattern;                // POSIX extended regex, or a literal with fixedStrings
+    bool fixedStrings = false;
+    bool ignoreCase = false;
+    std::vector<std::string> pathspecs; // path prefixes to search, empty searches everything
+};
+
+struct GrepMatch
+{
+    std::string path;
+    std::size_t lineNumber; // 1-based
+    std::string line;
+};
+
+// Searches every text blob under a tree without checking it out. Blobs are
+// inflated and scanned in parallel; matches come back in tree order.
+Result<std::vector<GrepMatch>> grep(const ObjectDatabase &objects, const std::string &treeHash,
+                                    const GrepOptions &options);
+
+// Archive
+
+enum class ArchiveFormat
+{
+    Tar,
+    TarGz,
+};
+
+// Streams a tree as a tar (optionally gzipped) without touching the disk. Blobs
+// are inflated a bounded window ahead in parallel and written in tree order.
+// commitHash is recorded in a pax global header like git archive does.
+Status writeArchive(const ObjectDatabase &objects, const std::string &commitHash, ArchiveFormat format,
+                    const std::string &prefix, std::ostream &out);
+
+// Diff
+
+// Splits after every '\n'; the last line may lack one
+std::vector<std::string> splitLines(const std::string &content);
+
+// For each line of a, the index of the line of b it is paired with on a shortest
+// edit script (Myers), or -1 when the line was removed
+std::vector<long> matchLines(const std::vector<std::string> &a, const std::vector<std::string> &b);
+
+enum class ChangeType
+{
+    Added,
+    Deleted,
+    Modified,
+    Renamed,
+    Copied,
+};
+
+struct FileChange
+{
+    ChangeType type;
+    std::string oldPath, newPath; // "" on the side that does not exist
+    std::string oldMode, newMode;
+    std::string oldHash, newHash;
+    int similarity = 0; // percent, for renames and copies
+};
+
+struct DiffOptions
+{
+    bool detectRenames = true;
+    bool detectCopies = false;  // modified files become copy sources as well
+    int threshold = 50;         // minimum similarity percent for an inexact pairing
+    std::size_t limit = 5000;   // inexact detection is skipped beyond limit x limit candidate pairs
+};
+
+// Changes between two trees ("" = empty tree), sorted by path. Subtrees with equal
+// hashes are skipped unread. Renames and copies are paired by object id first; the
+// remaining candidates are scored in parallel on sorted line/chunk fingerprints.
+Result<std::vector<FileChange>> diffTrees(const ObjectDatabase &objects, const std::string &oldTree,
+                                          const std::string &newTree, const DiffOptions &options = {});
+
+// Unified diff ("diff --git" header plus hunks with 3 lines of context) of one change
+Result<std::string> formatPatch(const ObjectDatabase &objects, const FileChange &change);
+
+// Merge
+
+struct CommitGraphEntry
+{
+    std::uint32_t generation = 0; // 1 for a root commit, otherwise 1 + the highest parent generation
+    std::int64_t time = 0;        // committer time
+    std::vector<std::string> parents;
+};
+
+// Generation numbers, commit times and parents, persisted in objects/info/commit-graph
+// so ancestry walks do not have to inflate commits. New commits are added as they are
+// written, anything else is computed on first lookup and appended by save(). Safe to
+// share between threads.
+class CommitGraph
+{
+public:
+    explicit CommitGraph(const ObjectDatabase &objects);
+
+    Result<CommitGraphEntry> lookup(const std::string &hash);
+    // Records a commit just written; skipped when a parent is not in the graph yet
+    Status add(const std::string &hash, const std::vector<std::string> &parents, std::int64_t time);
+    Status save();
+
+private:
+    const ObjectDatabase &objects_;
+    std::string path_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, CommitGraphEntry> entries_;
+    std::vector<std::string> unsaved_;
+};
+
+// Best common ancestors of two commits (usually one). The walk visits commits in
+// generation order and stops as soon as every remaining candidate is below a base.
+Result<std::vector<std::string>> mergeBases(CommitGraph &graph, const std::string &a, const std::string &b);
+
+// Whether ancestor is reachable from descendant; never walks below ancestor's generation
+Result<bool> isAncestor(CommitGraph &graph, const std::string &ancestor, const std::string &descendant);
+
+struct TreeMerge
+{
+    std::string tree;                   // merged tree, conflicted files carry conflict markers
+    std::vector<std::string> conflicts; // paths
+};
+
+// Three-way tree merge. Subtrees where two sides agree are taken by hash without being
+// read; blobs are only opened when both sides changed them differently. baseTree may be "".
+Result<TreeMerge> mergeTrees(const ObjectDatabase &objects, const std::string &baseTree, const std::string &ourTree,
+                             const std::string &theirTree, const std::string &ourLabel,
+                             const std::string &theirLabel);
+
+// Repository
+
+struct IndexEntry
+{
+    std::string hash;
+    std::string path; // relative to the work tree
+};
+
+struct CheckoutResult
+{
+    std::string commit;
+    std::string branch; // "" when HEAD was detached
+};
+
+struct MergeResult
+{
+    std::string commit;                 // new HEAD, "" when the merge stopped on conflicts
+    bool upToDate = false;
+    bool fastForward = false;
+    std::vector<std::string> conflicts;
+};
+
+struct GcResult
+{
+    std::size_t objects = 0;   // loose objects in this repository's store
+    std::size_t reachable = 0; // kept: reachable, or too recent to prune
+    std::size_t pruned = 0;
+};
+
+struct CloneResult
+{
+    std::size_t linked = 0;
+    std::size_t copied = 0;
+};
+
+class Repository
+{
+public:
+    static Result<std::unique_ptr<Repository>> open(const std::string &workTree = ".");
+    static Result<std::unique_ptr<Repository>> init(const std::string &workTree = ".");
+
+    const std::string &workTree() const { return workTree_; }
+    const std::string &gitDir() const { return gitDir_; }
+    ObjectDatabase &objects() { return *objects_; }
+    RefStore &refs() { return *refs_; }
+
+    // Stores blobs for the given files (directories recursively) and appends them to the index
+    Result<std::vector<IndexEntry>> add(const std::vector<std::string> &paths);
+
+    // Snapshots the work tree (only the sparse cone, when one is set) and returns the root tree hash
+    Result<std::string> writeTree();
+
+    // Snapshots the work tree and moves HEAD to the new commit
+    Result<std::string> commit(const std::string &message);
+
+    // Switches to a branch, or detaches HEAD at any other commit-ish
+    Result<CheckoutResult> checkout(const std::string &target);
+
+    // Merges a commit-ish into HEAD: fast-forwards when possible, otherwise commits a
+    // three-way merge. On conflicts the marked-up files are left in the work tree and
+    // .git/MERGE_HEAD is recorded so the next commit gets both parents.
+    Result<MergeResult> merge(const std::string &target);
+
+    CommitGraph &commitGraph() { return *commitGraph_; }
+
+    // Deletes loose objects that are unreachable and last written before pruneBefore (epoch
+    // seconds). Roots are refs, HEAD, MERGE_HEAD, the index (sparse tree entries included)
+    // and every object newer than the cutoff. Marking runs in parallel into a bitset over
+    // the store's objects, then the fan-out directories are swept concurrently. The loose
+    // objects left behind are recorded in .git/gc.log for needsGc().
+    Result<GcResult> gc(std::int64_t pruneBefore);
+
+    // Loose objects in this store, estimated from one fan-out directory like git gc --auto
+    std::size_t estimateLooseObjects() const;
+
+    // Whether more than threshold loose objects were written since the last gc. Reachable
+    // objects stay loose (there are no packs), so the count gc left behind is the baseline.
+    bool needsGc(std::size_t threshold) const;
+
+    // Rewrites only the work tree paths that differ between two commits ("" = empty tree).
+    // Fails with LocalChanges, touching nothing, if that would clobber uncommitted edits.
+    Status updateWorkTree(const std::string &fromCommit, const std::string &toCommit);
+
+    // Index entries in file order. Sparse directory entries carry a tree hash and a path ending in '/'.
+    Result<std::vector<IndexEntry>> readIndex() const;
+
+    // Sparse checkout in cone mode: only these directories (recursively), plus the files directly
+    // inside their ancestors, are materialized and scanned. Empty when sparse checkout is off.
+    const std::vector<std::string> &sparseCone() const { return sparseCone_; }
+    Status setSparseCheckout(const std::vector<std::string> &directories);
+    Status disableSparseCheckout();
+
+private:
+    Repository(std::string workTree);
+
+    std::string path(const std::string &relative) const;
+    Status switchTree(const std::string &fromTree, const std::string &toTree);
+    Status applyWorkTreeChange(const std::map<std::string, std::string> &oldFiles,
+                               const std::map<std::string, std::string> &newFiles);
+    Result<std::map<std::string, std::string>> collapsedDirectories();
+    Status rewriteIndex(const std::map<std::string, std::string> &collapsed, bool keepStaged);
+    Result<std::string> writeCommit(const std::string &tree, const std::vector<std::string> &parents,
+                                    const std::string &message);
+
+    std::string workTree_;
+    std::string gitDir_;
+    std::unique_ptr<ObjectDatabase> objects_;
+    std::unique_ptr<RefStore> refs_;
+    std::unique_ptr<CommitGraph> commitGraph_;
+    std::vector<std::string> sparseCone_;
+};
+
+// Clones a local repository, hardlinking its object files (or, with shared, only
+// recording the source in objects/info/alternates), then checks out HEAD.
+Result<CloneResult> clone(const std::string &source, const std::string &destination, bool shared);
+
+} // namespace mygit
+
+#endif
@@ -0,0 +1,503 @@
+#include "libmygit.hpp"
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
+namespace mygit
+{
+
+using namespace std;
+
+// Commit graph
+//
+// One line per commit: "<hash> <generation> <time> [<parent>...]"
+
+CommitGraph::CommitGraph(const ObjectDatabase &objects)
+    : objects_(objects), path_(objects.directory() + "/info/commit-graph")
+{
+    ifstream file(path_);
+    string line;
+    while (getline(file, line))
+    {
+        stringstream ss(line);
+        string hash;
+        CommitGraphEntry entry;
+        if (!(ss >> hash >> entry.generation >> entry.time) || !isHexHash(hash))
+            continue; // a torn append, the commit is simply recomputed
+        string parent;
+        while (ss >> parent)
+            entry.parents.push_back(parent);
+        entries_[hash] = std::move(entry);
+    }
+}
+
+Result<CommitGraphEntry> CommitGraph::lookup(const string &hash)
+{
+    lock_guard<mutex> lock(mutex_);
+
+    auto found = entries_.find(hash);
+    if (found != entries_.end())
+        return found->second;
+
+    // Post-order walk down to commits we already know, parents are always finished first
+    unordered_map<string, Commit> parsed;
+    vector<string> pending{hash};
+    while (!pending.empty())
+    {
+        const string current = pending.back();
+        if (entries_.count(current))
+        {
+            pending.pop_back();
+            continue;
+        }
+
+        auto it = parsed.find(current);
+        if (it == parsed.end())
+        {
+            Result<Commit> commit = objects_.readCommit(current, CommitCommitter);
+            if (!commit)
+                return std::unexpected(commit.error());
+            it = parsed.emplace(current, std::move(*commit)).first;
+        }
+
+        bool ready = true;
+        for (const string &parent : it->second.parents)
+        {
+            if (!entries_.count(parent))
+            {
+                pending.push_back(parent);
+                ready = false;
+            }
+        }
+        if (!ready)
+            continue;
+
+        CommitGraphEntry entry;
+        entry.generation = 1;
+        entry.time = commitTime(it->second);
+        entry.parents = it->second.parents;
+        for (const string &parent : entry.parents)
+            entry.generation = max(entry.generation, entries_[parent].generation + 1);
+
+        entries_[current] = std::move(entry);
+        unsaved_.push_back(current);
+        pending.pop_back();
+    }
+    return entries_[hash];
+}
+
+Status CommitGraph::add(const string &hash, const vector<string> &parents, int64_t time)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (entries_.count(hash))
+            return {};
+
+        CommitGraphEntry entry;
+        entry.generation = 1;
+        entry.time = time;
+        entry.parents = parents;
+        for (const string &parent : parents)
+        {
+            auto found = entries_.find(parent);
+            if (found == entries_.end())
+                return {}; // history the graph has not seen yet, lookup fills it in later
+            entry.generation = max(entry.generation, found->second.generation + 1);
+        }
+        entries_[hash] = std::move(entry);
+        unsaved_.push_back(hash);
+    }
+    return save();
+}
+
+Status CommitGraph::save()
+{
+    lock_guard<mutex> lock(mutex_);
+    if (unsaved_.empty())
+        return {};
+
+    string data;
+    for (const string &hash : unsaved_)
+    {
+        const CommitGraphEntry &entry = entries_[hash];
+        data += hash + " " + to_string(entry.generation) + " " + to_string(entry.time);
+        for (const string &parent : entry.parents)
+            data += " " + parent;
+        data += "\n";
+    }
+
+    // Entries never change, so appending is enough
+    error_code ec;
+    filesystem::create_directories(filesystem::path(path_).parent_path(), ec);
+    ofstream file(path_, ios::app);
+    file << data;
+    file.close();
+    if (file.fail())
+        return fail(ErrorCode::IoError, "Failed to write " + path_);
+    unsaved_.clear();
+    return {};
+}
+
+namespace
+{
+
+enum : uint8_t
+{
+    PARENT1 = 1,
+    PARENT2 = 2,
+    STALE = 4,
+    RESULT = 8,
+};
+
+struct QueuedCommit
+{
+    uint32_t generation;
+    int64_t time;
+    string hash;
+
+    // Highest generation first, newer commits break ties
+    bool operator<(const QueuedCommit &other) const
+    {
+        if (generation != other.generation)
+            return generation < other.generation;
+        return time < other.time;
+    }
+};
+
+// Line-level three-way merge, diff3 style
+
+string joinLines(const vector<string> &lines, size_t begin, size_t end)
+{
+    string out;
+    for (size_t i = begin; i < end; ++i)
+        out += lines[i];
+    return out;
+}
+
+// Returns true when the merge is clean; merged gets conflict markers otherwise
+bool mergeContent(const string &baseContent, const string &ourContent, const string &theirContent,
+                  const string &ourLabel, const string &theirLabel, string &merged)
+{
+    vector<string> base = splitLines(baseContent), ours = splitLines(ourContent), theirs = splitLines(theirContent);
+    vector<long> toOurs = matchLines(base, ours), toTheirs = matchLines(base, theirs);
+
+    bool clean = true;
+    size_t i = 0, j = 0, k = 0;
+    while (true)
+    {
+        // Lines all three sides agree on
+        while (i < base.size() && toOurs[i] == static_cast<long>(j) && toTheirs[i] == static_cast<long>(k))
+        {
+            merged += base[i];
+            ++i, ++j, ++k;
+        }
+        if (i >= base.size() && j >= ours.size() && k >= theirs.size())
+            break;
+
+        // The next base line both sides kept ends the unstable chunk
+        size_t nextI = i;
+        while (nextI < base.size() && (toOurs[nextI] < 0 || toTheirs[nextI] < 0))
+            ++nextI;
+        size_t nextJ = nextI < base.size() ? toOurs[nextI] : ours.size();
+        size_t nextK = nextI < base.size() ? toTheirs[nextI] : theirs.size();
+
+        string o = joinLines(base, i, nextI), a = joinLines(ours, j, nextJ), b = joinLines(theirs, k, nextK);
+        if (a == b || b == o)
+        {
+            merged += a;
+        }
+        else if (a == o)
+        {
+            merged += b;
+        }
+        else
+        {
+            clean = false;
+            auto terminated = [](string s)
+            {
+                if (!s.empty() && s.back() != '\n')
+                    s += '\n';
+                return s;
+            };
+            merged += "<<<<<<< " + ourLabel + "\n" + terminated(a) + "=======\n" + terminated(b) +
+                      ">>>>>>> " + theirLabel + "\n";
+        }
+        i = nextI, j = nextJ, k = nextK;
+    }
+    return clean;
+}
+
+struct TreeMerger
+{
+    const ObjectDatabase &objects;
+    const string &ourLabel;
+    const string &theirLabel;
+    vector<string> conflicts;
+
+    Result<string> blobContent(const optional<TreeEntry> &entry)
+    {
+        if (!entry || entry->isTree())
+            return string();
+        Result<Object> blob = objects.read(entry->hash);
+        if (!blob)
+            return std::unexpected(blob.error());
+        return std::move(blob->content);
+    }
+
+    Result<vector<TreeEntry>> entriesOf(const string &treeHash)
+    {
+        if (treeHash.empty())
+            return vector<TreeEntry>();
+        return objects.readTree(treeHash);
+    }
+
+    // Merged tree hash, "" when nothing is left in it
+    Result<string> merge(const string &base, const string &ours, const string &theirs, const string &prefix)
+    {
+        // Two sides agree: take the subtree whole, nothing below is read
+        if (ours == theirs || base == theirs)
+            return ours;
+        if (base == ours)
+            return theirs;
+
+        Result<vector<TreeEntry>> baseEntries = entriesOf(base), ourEntries = entriesOf(ours),
+                                  theirEntries = entriesOf(theirs);
+        if (!baseEntries)
+            return std::unexpected(baseEntries.error());
+        if (!ourEntries)
+            return std::unexpected(ourEntries.error());
+        if (!theirEntries)
+            return std::unexpected(theirEntries.error());
+
+        map<string, array<optional<TreeEntry>, 3>> byName;
+        for (const auto &entry : *baseEntries)
+            byName[entry.name][0] = entry;
+        for (const auto &entry : *ourEntries)
+            byName[entry.name][1] = entry;
+        for (const auto &entry : *theirEntries)
+            byName[entry.name][2] = entry;
+
+        auto same = [](const optional<TreeEntry> &x, const optional<TreeEntry> &y)
+        { return x.has_value() == y.has_value() && (!x || (x->mode == y->mode && x->hash == y->hash)); };
+
+        vector<TreeEntry> merged;
+        for (const auto &[name, sides] : byName)
+        {
+            const auto &[b, o, t] = sides;
+            string path = prefix + name;
+
+            optional<TreeEntry> result;
+            if (same(o, t) || same(b, t))
+            {
+                result = o;
+            }
+            else if (same(b, o))
+            {
+                result = t;
+            }
+            else if (o && t && o->isTree() && t->isTree())
+            {
+                Result<string> subtree = merge(b && b->isTree() ? b->hash : "", o->hash, t->hash, path + "/");
+                if (!subtree)
+                    return subtree;
+                if (!subtree->empty())
+                    result = TreeEntry{"40000", name, *subtree};
+            }
+            else if (o && t && !o->isTree() && !t->isTree())
+            {
+                // Both sides changed the file: the only place blobs are opened
+                Result<string> baseContent = blobContent(b), ourContent = blobContent(o),
+                               theirContent = blobContent(t);
+                if (!baseContent)
+                    return baseContent;
+                if (!ourContent)
+                    return ourContent;
+                if (!theirContent)
+                    return theirContent;
+
+                string content;
+                if (!mergeContent(*baseContent, *ourContent, *theirContent, ourLabel, theirLabel, content))
+                    conflicts.push_back(path);
+
+                Result<string> hash = objects.write("blob", content);
+                if (!hash)
+                    return hash;
+                string mode = b && o->mode == b->mode ? t->mode : o->mode;
+                result = TreeEntry{mode, name, *hash};
+            }
+            else
+            {
+                // Modified on one side and deleted (or turned into a directory) on the other: keep what is there
+                conflicts.push_back(path);
+                result = o ? o : t;
+            }
+
+            if (result)
+                merged.push_back(TreeEntry{result->mode, name, result->hash});
+        }
+
+        if (merged.empty())
+            return string();
+        return objects.writeTree(std::move(merged));
+    }
+};
+
+} // namespace
+
+Result<vector<string>> mergeBases(CommitGraph &graph, const string &a, const string &b)
+{
+    if (a == b)
+        return vector<string>{a};
+
+    unordered_map<string, uint8_t> flags;
+    vector<QueuedCommit> queue; // heap
+    unordered_map<string, size_t> queued; // queue entries per commit
+    size_t active = 0;                    // queue entries whose commit is not stale
+
+    auto push = [&](const string &hash, uint8_t flag) -> Status
+    {
+        Result<CommitGraphEntry> entry = graph.lookup(hash);
+        if (!entry)
+            return std::unexpected(entry.error());
+        uint8_t &hashFlags = flags[hash];
+        if (!(hashFlags & STALE) && (flag & STALE))
+            active -= queued[hash]; // its earlier entries just went stale
+        hashFlags |= flag;
+        ++queued[hash];
+        if (!(hashFlags & STALE))
+            ++active;
+        queue.push_back(QueuedCommit{entry->generation, entry->time, hash});
+        push_heap(queue.begin(), queue.end());
+        return {};
+    };
+
+    Status status = push(a, PARENT1);
+    if (status)
+        status = push(b, PARENT2);
+    if (!status)
+        return std::unexpected(status.error());
+
+    // Paint down from both tips; anything reached from a common ancestor is stale,
+    // and the walk ends once only stale commits are left
+    vector<string> results;
+    while (active > 0)
+    {
+        pop_heap(queue.begin(), queue.end());
+        QueuedCommit current = std::move(queue.back());
+        queue.pop_back();
+
+        uint8_t &currentFlags = flags[current.hash];
+        --queued[current.hash];
+        if (!(currentFlags & STALE))
+            --active;
+        uint8_t paint = currentFlags & (PARENT1 | PARENT2 | STALE);
+        if (paint == (PARENT1 | PARENT2))
+        {
+            if (!(currentFlags & RESULT))
+            {
+                currentFlags |= RESULT;
+                results.push_back(current.hash);
+            }
+            paint |= STALE;
+        }
+
+        Result<CommitGraphEntry> entry = graph.lookup(current.hash);
+        if (!entry)
+            return std::unexpected(entry.error());
+        for (const string &parent : entry->parents)
+        {
+            if ((flags[parent] & paint) == paint)
+                continue;
+            status = push(parent, paint);
+            if (!status)
+                return std::unexpected(status.error());
+        }
+    }
+
+    // With criss-cross merges some results can be ancestors of others
+    vector<string> best;
+    for (const string &candidate : results)
+    {
+        bool redundant = false;
+        for (const string &other : results)
+        {
+            if (other == candidate)
+                continue;
+            Result<bool> below = isAncestor(graph, candidate, other);
+            if (!below)
+                return std::unexpected(below.error());
+            if (*below)
+            {
+                redundant = true;
+                break;
+            }
+        }
+        if (!redundant)
+            best.push_back(candidate);
+    }
+
+    status = graph.save();
+    if (!status)
+        return std::unexpected(status.error());
+    return best;
+}
+
+Result<bool> isAncestor(CommitGraph &graph, const string &ancestor, const string &descendant)
+{
+    Result<CommitGraphEntry> target = graph.lookup(ancestor);
+    if (!target)
+        return std::unexpected(target.error());
+
+    unordered_set<string> seen{descendant};
+    vector<string> pending{descendant};
+    while (!pending.empty())
+    {
+        string current = pending.back();
+        pending.pop_back();
+        if (current == ancestor)
+            return true;
+
+        Result<CommitGraphEntry> entry = graph.lookup(current);
+        if (!entry)
+            return std::unexpected(entry.error());
+        if (entry->generation <= target->generation)
+            continue; // nothing below here can reach a commit of equal or higher generation
+
+        for (const string &parent : entry->parents)
+        {
+            if (seen.insert(parent).second)
+                pending.push_back(parent);
+        }
+    }
+    return false;
+}
+
+Result<TreeMerge> mergeTrees(const ObjectDatabase &objects, const string &baseTree, const string &ourTree,
+                             const string &theirTree, const string &ourLabel, const string &theirLabel)
+{
+    TreeMerger merger{objects, ourLabel, theirLabel, {}};
+    Result<string> tree = merger.merge(baseTree, ourTree, theirTree, "");
+    if (!tree)
+        return std::unexpected(tree.error());
+
+    TreeMerge result;
+    result.conflicts = std::move(merger.conflicts);
+    if (!tree->empty())
+    {
+        result.tree = *tree;
+    }
+    else
+    {
+        Result<string> empty = objects.writeTree(vector<TreeEntry>());
+        if (!empty)
+            return std::unexpected(empty.error());
+        result.tree = *empty;
+    }
+    return result;
+}
+
+} // namespace mygit
@@ -1,645 +1,985 @@
 #include <iostream>
 #include <filesystem>
-#include <dirent.h>
 #include <fstream>
 #include <string>
 #include <vector>
-#include <zlib.h>
 #include <algorithm>
-#include <openssl/sha.h>
-#include <fcntl.h>
-#include <ctime>
-#include <sstream>
-#include <iomanip>
-#include <cstring>
+
+#include "libmygit.hpp"
 
 using namespace std;
+using namespace mygit;
 
-string callCreatingBlobObject(const string &fileName, const string &flag);
-string writeTree(const string &directoryPath);
-void lsTree(const string &treeHash, const string &flag);
-void mygitAdd(const vector<string> &files);
-void mygitCommit(const string &message);
+// The CLI is a thin layer over libmygit: parse arguments, call the library, print.
+
+unique_ptr<Repository> openRepository()
+{
+    Result<unique_ptr<Repository>> repo = Repository::open(".");
+    if (!repo)
+    {
+        cerr << "Error: " << repo.error().message << "\n";
+        return nullptr;
+    }
+    return std::move(*repo);
+}
+
+int reportError(const Error &error)
+{
+    cerr << "Error: " << error.message << "\n";
+    return EXIT_FAILURE;
+}
 
 string callCreatingBlobObject(const string &fileName, const string &flag)
 {
-    ifstream file(fileName, ios::binary); // Binary mode
-    if (!file.is_open())
+    Result<string> content = readFile(fileName);
+    if (!content)
     {
         cerr << "Error: No such file or directory exists.\n";
         return "";
     }
 
-    
-    stringstream buffer;
-    buffer << file.rdbuf();
-    string content = buffer.str();
-    unsigned long long size = content.size();
-
-    
-    string blob_obj = "blob " + to_string(size) + '\0' + content;
+    // If the -w flag is present, write the object to the .git/objects directory
+    if (flag != "-w")
+        return hashObject("blob", *content);
 
-    
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    SHA1(reinterpret_cast<const unsigned char *>(blob_obj.c_str()), blob_obj.size(), hash);
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return "";
 
-    
-    stringstream ss;
-    for (int i = 0; i < SHA_DIGEST_LENGTH; ++i)
+    Result<string> hash = repo->objects().write("blob", *content);
+    if (!hash)
     {
-        ss << hex << setw(2) << setfill('0') << static_cast<unsigned int>(hash[i]);
+        reportError(hash.error());
+        return "";
     }
-    string hashStr = ss.str();
+    return *hash;
+}
 
-    // If the -w flag is present, write the object to the .git/objects directory
-    if (flag == "-w")
-    {
-        string folder = hashStr.substr(0, 2);
-        string fileNamePart = hashStr.substr(2);
-        string folderPath = ".git/objects/" + folder;
+// ls-tree function
 
-        if (!filesystem::exists(folderPath))
-        {
-            if (!filesystem::create_directory(folderPath))
-            {
-                cerr << "Error: Failed to create directory " << folderPath << "\n";
-                return "";
-            }
-        }
+int lsTree(const string &treeHash, const string &flag)
+{
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
+
+    // readTree also looks in alternate object stores
+    Result<vector<TreeEntry>> entries = repo->objects().readTree(treeHash);
+    if (!entries)
+        return reportError(entries.error());
 
-        // Compress the blob object
-        uLongf compressedSize = compressBound(blob_obj.size());
-        vector<unsigned char> compressedBuffer(compressedSize);
+    for (const auto &entry : *entries)
+    {
+        string type = entry.isTree() ? "tree" : "blob";
 
-        int result = compress(compressedBuffer.data(), &compressedSize,
-                              reinterpret_cast<const Bytef *>(blob_obj.data()), blob_obj.size());
-        if (result != Z_OK)
+        if (flag == "--name-only")
         {
-            cerr << "Error: Failed to compress data. Result code: " << result << "\n";
-            return "";
+            cout << entry.name << endl;
         }
-
-        compressedBuffer.resize(compressedSize);
-
-        ofstream outFile(folderPath + "/" + fileNamePart, ios::binary);
-        if (!outFile.is_open())
+        else
         {
-            cerr << "Error: Failed to create file.\n";
-            return "";
+            cout << entry.mode << " " << type << " " << entry.hash << " " << entry.name << endl;
         }
-
-        outFile.write(reinterpret_cast<const char *>(compressedBuffer.data()),
-                      static_cast<std::streamsize>(compressedSize));
-        outFile.close();
     }
-    // else
-    // {
-    //     // Print the hash to the console if flag is not "-w"
-    //     cout << hashStr << endl;
-    // }
-
-    // Return the hash string
-    return hashStr;
+    return EXIT_SUCCESS;
 }
 
-// Write tree function
+// Diff functions
+
+enum class DiffOutput
+{
+    None,
+    NameStatus,
+    Patch,
+};
 
-void hexStringToBinary(const string &hexStr, unsigned char *binaryHash)
+// Parses the diff options shared by diff and log, returns false for anything else
+bool parseDiffOption(const string &arg, DiffOptions &options, DiffOutput &output)
 {
-    for (size_t i = 0; i < SHA_DIGEST_LENGTH; ++i)
+    if (arg == "-p" || arg == "--patch")
+        output = DiffOutput::Patch;
+    else if (arg == "--name-status")
+        output = DiffOutput::NameStatus;
+    else if (arg == "--no-renames")
+        options.detectRenames = false;
+    else if (arg == "-C" || arg == "--find-copies")
+        options.detectRenames = options.detectCopies = true;
+    else if (arg.rfind("-M", 0) == 0 || arg.rfind("--find-renames", 0) == 0)
     {
-        string byteString = hexStr.substr(i * 2, 2);
-        binaryHash[i] = (unsigned char)strtol(byteString.c_str(), nullptr, 16);
+        // -M<n> / --find-renames=<n>, n in percent
+        options.detectRenames = true;
+        size_t digits = arg.find_first_of("0123456789");
+        if (digits != string::npos)
+            options.threshold = clamp(atoi(arg.c_str() + digits), 0, 100);
     }
+    else
+        return false;
+    return true;
 }
 
-string writeTree(const string &directoryPath)
+Status formatChanges(Repository &repo, const string &oldTree, const string &newTree, const DiffOptions &options,
+                     DiffOutput output, string &out)
 {
-    struct TreeEntry
-    {
-        string mode;
-        string filename;
-        unsigned char hash[SHA_DIGEST_LENGTH];
-    };
-
-    vector<TreeEntry> entries;
+    Result<vector<FileChange>> changes = diffTrees(repo.objects(), oldTree, newTree, options);
+    if (!changes)
+        return std::unexpected(changes.error());
 
-    for (const auto &entry : filesystem::directory_iterator(directoryPath))
+    for (const auto &change : *changes)
     {
-        if (entry.path().filename() == ".git")
-            continue; // need to skip the .git directory
-
-        string filename = entry.path().filename().string();
-        string mode;
-        unsigned char hash[SHA_DIGEST_LENGTH];
-
-        if (entry.is_directory())
+        if (output == DiffOutput::Patch)
         {
-            // Recursively for subdirectories
-            string subtreeHashHex = writeTree(entry.path().string());
-
-            
-            hexStringToBinary(subtreeHashHex, hash);
-
-            mode = "40000";
+            Result<string> patch = formatPatch(repo.objects(), change);
+            if (!patch)
+                return std::unexpected(patch.error());
+            out += *patch;
+            continue;
         }
-        else if (entry.is_regular_file())
-        {
-            
-            string filePath = entry.path().string();
-            string blobHashHex = callCreatingBlobObject(filePath, "-w");
-
-            
-            hexStringToBinary(blobHashHex, hash);
 
-            mode = "100644";
-        }
-        else
+        switch (change.type)
+        {
+        case ChangeType::Added:
+            out += "A\t" + change.newPath + "\n";
+            break;
+        case ChangeType::Deleted:
+            out += "D\t" + change.oldPath + "\n";
+            break;
+        case ChangeType::Modified:
+            out += "M\t" + change.newPath + "\n";
+            break;
+        case ChangeType::Renamed:
+        case ChangeType::Copied:
         {
-            continue; // need to skip other type
+            char score[8];
+            snprintf(score, sizeof(score), "%03d", change.similarity);
+            out += (change.type == ChangeType::Renamed ? "R" : "C") + string(score) + "\t" + change.oldPath +
+                   "\t" + change.newPath + "\n";
+            break;
+        }
         }
-
-        TreeEntry treeEntry = {mode, filename, {0}};
-        memcpy(treeEntry.hash, hash, SHA_DIGEST_LENGTH);
-        entries.push_back(treeEntry);
     }
+    return {};
+}
 
-
-    sort(entries.begin(), entries.end(), [](const TreeEntry &a, const TreeEntry &b)
-              { return a.filename < b.filename; });
-
-
-    vector<char> treeContent;
-    for (const auto &entry : entries)
+int mygitDiff(const vector<string> &args)
+{
+    DiffOptions options;
+    DiffOutput output = DiffOutput::Patch;
+    vector<string> revisions;
+    for (const string &arg : args)
     {
-        string entryStr = entry.mode + ' ' + entry.filename;
-        treeContent.insert(treeContent.end(), entryStr.begin(), entryStr.end());
-        treeContent.push_back('\0'); // Null terminator
-
-        
-        treeContent.insert(treeContent.end(), entry.hash, entry.hash + SHA_DIGEST_LENGTH);
+        if (!parseDiffOption(arg, options, output))
+            revisions.push_back(arg);
     }
-
-    string header = "tree " + to_string(treeContent.size()) + '\0';
-    string treeObj = header + string(treeContent.begin(), treeContent.end());
-
-    // Computing SHA-1
-    unsigned char treeHash[SHA_DIGEST_LENGTH];
-    SHA1(reinterpret_cast<const unsigned char *>(treeObj.c_str()), treeObj.size(), treeHash);
-
-
-    stringstream ss;
-    for (int i = 0; i < SHA_DIGEST_LENGTH; ++i)
+    if (revisions.empty() || revisions.size() > 2)
     {
-        ss << hex << setw(2) << setfill('0') << static_cast<unsigned int>(treeHash[i]);
+        cerr << "Usage: ./mygit diff [-p | --name-status] [-M[<n>]] [-C] [--no-renames] <commit> [<commit>]\n";
+        return EXIT_FAILURE;
     }
-    string treeHashHex = ss.str();
 
-    // Now we need to write the tree object to the .git/objects directory
-    string folder = treeHashHex.substr(0, 2);
-    string fileNamePart = treeHashHex.substr(2);
-    string folderPath = ".git/objects/" + folder;
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-    if (!filesystem::exists(folderPath))
+    vector<Commit> commits;
+    for (const string &revision : revisions)
     {
-        filesystem::create_directory(folderPath);
+        Result<string> hash = repo->refs().resolve(revision);
+        Result<Commit> commit = hash ? repo->objects().readCommit(*hash) : std::unexpected(hash.error());
+        if (!commit)
+        {
+            cerr << "Not a valid commit: " << revision << "\n";
+            return EXIT_FAILURE;
+        }
+        commits.push_back(std::move(*commit));
     }
 
-    uLongf compressedSize = compressBound(treeObj.size());
-    vector<unsigned char> compressedBuffer(compressedSize);
-
-    int result = compress(compressedBuffer.data(), &compressedSize,
-                          reinterpret_cast<const Bytef *>(treeObj.data()), treeObj.size());
-    if (result != Z_OK)
+    // A single commit is compared against its first parent
+    string oldTree, newTree = commits.back().tree;
+    if (commits.size() == 2)
     {
-        cerr << "Error: Failed to compress tree object. Result code: " << result << "\n";
-        return "";
+        oldTree = commits[0].tree;
     }
-
-    compressedBuffer.resize(compressedSize);
-
-    ofstream outFile(folderPath + "/" + fileNamePart, ios::binary);
-    if (!outFile.is_open())
+    else if (!commits[0].parents.empty())
     {
-        cerr << "Error: Failed to write tree object.\n";
-        return "";
+        Result<Commit> parent = repo->objects().readCommit(commits[0].parents.front());
+        if (!parent)
+            return reportError(parent.error());
+        oldTree = parent->tree;
     }
 
-    outFile.write(reinterpret_cast<const char *>(compressedBuffer.data()),
-                  static_cast<std::streamsize>(compressedSize));
-    outFile.close();
-
-    return treeHashHex;
+    string out;
+    Status status = formatChanges(*repo, oldTree, newTree, options, output, out);
+    if (!status)
+        return reportError(status.error());
+    cout << out;
+    return EXIT_SUCCESS;
 }
 
-// ls-tree function
+// Log functions
 
-void lsTree(const string &treeHash, const string &flag)
-{
-    string folderName = treeHash.substr(0, 2);
-    string fileName = treeHash.substr(2);
-    string completeFilePath = ".git/objects/" + folderName + "/" + fileName;
+const size_t LOG_FLUSH_SIZE = 1 << 16; // output is handed to cout in blocks of about this size
 
-    if (!filesystem::exists(completeFilePath))
+// "name <email> date" from an author or committer line
+void splitPerson(const string &line, string &name, string &email, string &date)
+{
+    size_t open = line.find('<'), close = line.find('>');
+    if (open == string::npos || close == string::npos || close < open)
     {
-        cerr << "Not a valid object name " << treeHash << "\n";
+        name = line;
+        email = date = "";
         return;
     }
+    name = line.substr(0, open > 0 ? open - 1 : 0);
+    email = line.substr(open + 1, close - open - 1);
+    date = close + 2 <= line.size() ? line.substr(close + 2) : "";
+}
 
-    ifstream file(completeFilePath, ios::binary);
-    if (!file.is_open())
+// Fields a --format template needs, so the rest of each commit is never parsed
+unsigned fieldsForFormat(const string &format)
+{
+    unsigned fields = 0;
+    for (size_t i = 0; i + 1 < format.size(); ++i)
     {
-        cerr << "Error: Failed to open tree object file.\n";
-        return;
+        if (format[i] != '%')
+            continue;
+        char c = format[++i];
+        if (c == 'T' || c == 't')
+            fields |= CommitTree;
+        else if (c == 'a')
+            fields |= CommitAuthor;
+        else if (c == 'c')
+            fields |= CommitCommitter;
+        else if (c == 's' || c == 'b' || c == 'B')
+            fields |= CommitMessage;
     }
+    return fields;
+}
 
-    vector<unsigned char> compressedData((istreambuf_iterator<char>(file)),
-                                         istreambuf_iterator<char>());
-    file.close();
+// Expands %H %h %T %t %P %p %an %ae %ad %cn %ce %cd %s %b %B %n and %%
+string formatCommit(const Commit &c, const string &format)
+{
+    string out;
+    for (size_t i = 0; i < format.size(); ++i)
+    {
+        if (format[i] != '%' || i + 1 == format.size())
+        {
+            out += format[i];
+            continue;
+        }
 
-    uLongf decompressedSize = compressedData.size() * 100; // Estimating decompressed size
-    vector<unsigned char> decompressedBuffer(decompressedSize);
+        char c1 = format[++i];
+        switch (c1)
+        {
+        case 'H':
+            out += c.hash;
+            break;
+        case 'h':
+            out += c.hash.substr(0, 7);
+            break;
+        case 'T':
+            out += c.tree;
+            break;
+        case 't':
+            out += c.tree.substr(0, 7);
+            break;
+        case 'P':
+        case 'p':
+            for (size_t p = 0; p < c.parents.size(); ++p)
+                out += (p ? " " : "") + (c1 == 'P' ? c.parents[p] : c.parents[p].substr(0, 7));
+            break;
+        case 's':
+            out += c.message.substr(0, c.message.find('\n'));
+            break;
+        case 'b':
+        {
+            size_t bodyStart = c.message.find("\n\n");
+            out += bodyStart == string::npos ? "" : c.message.substr(bodyStart + 2);
+            break;
+        }
+        case 'B':
+            out += c.message;
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        case '%':
+            out += '%';
+            break;
+        case 'a':
+        case 'c':
+        {
+            if (i + 1 == format.size())
+            {
+                out += string("%") + c1;
+                break;
+            }
+            char part = format[++i];
+            string name, email, date;
+            splitPerson(c1 == 'a' ? c.author : c.committer, name, email, date);
+            if (part == 'n')
+                out += name;
+            else if (part == 'e')
+                out += email;
+            else if (part == 'd')
+                out += date;
+            else
+                out += string("%") + c1 + part;
+            break;
+        }
+        default:
+            out += string("%") + c1;
+        }
+    }
+    return out;
+}
 
-    int result = uncompress(decompressedBuffer.data(), &decompressedSize,
-                            compressedData.data(), compressedData.size());
-    if (result != Z_OK)
+int mygitLog(const vector<string> &args)
+{
+    DiffOptions options;
+    DiffOutput output = DiffOutput::None;
+    long long maxCount = -1;
+    optional<int64_t> since, until;
+    optional<string> format;
+    bool firstParent = false;
+
+    auto usage = []
     {
-        cerr << "Error: Failed to decompress tree object. Result code: " << result << "\n";
-        return;
-    }
+        cerr << "Usage: ./mygit log [-n <count>] [--since=<date>] [--until=<date>] [--oneline | --format=<fmt>]"
+                " [--first-parent] [-p | --name-status] [-M[<n>]] [-C] [--no-renames]\n";
+        return EXIT_FAILURE;
+    };
+    auto parseCount = [&](const string &text)
+    {
+        char *end = nullptr;
+        maxCount = strtoll(text.c_str(), &end, 10);
+        return !text.empty() && *end == '\0' && maxCount >= 0;
+    };
+    auto parseDateOption = [&](const string &text, optional<int64_t> &target)
+    {
+        Result<int64_t> date = parseDate(text);
+        if (!date)
+            return false;
+        target = *date;
+        return true;
+    };
 
-    decompressedBuffer.resize(decompressedSize);
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        const string &arg = args[i];
+        bool ok = true;
+        if (arg == "-n" && i + 1 < args.size())
+            ok = parseCount(args[++i]);
+        else if (arg.rfind("--max-count=", 0) == 0)
+            ok = parseCount(arg.substr(12));
+        else if (arg.size() > 2 && arg.rfind("-n", 0) == 0)
+            ok = parseCount(arg.substr(2));
+        else if (arg.size() > 1 && arg[0] == '-' && isdigit(static_cast<unsigned char>(arg[1])))
+            ok = parseCount(arg.substr(1));
+        else if (arg.rfind("--since=", 0) == 0 || arg.rfind("--after=", 0) == 0)
+            ok = parseDateOption(arg.substr(8), since);
+        else if (arg.rfind("--until=", 0) == 0)
+            ok = parseDateOption(arg.substr(8), until);
+        else if (arg.rfind("--before=", 0) == 0)
+            ok = parseDateOption(arg.substr(9), until);
+        else if (arg == "--oneline")
+            format = "%h %s";
+        else if (arg.rfind("--format=", 0) == 0)
+            format = arg.substr(9);
+        else if (arg.rfind("--pretty=format:", 0) == 0)
+            format = arg.substr(16);
+        else if (arg == "--first-parent")
+            firstParent = true;
+        else
+            ok = parseDiffOption(arg, options, output);
+        if (!ok)
+            return usage();
+    }
 
-    size_t index = 0;
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-    // need to skip the header
-    while (index < decompressedBuffer.size() && decompressedBuffer[index] != '\0')
+    Result<string> head = repo->refs().resolve("HEAD");
+    if (!head)
     {
-        index++;
+        cerr << "Error: Failed to read current branch reference.\n";
+        return EXIT_FAILURE;
     }
-    index++; 
 
-    while (index < decompressedBuffer.size())
+    // Only parse what gets printed
+    unsigned fields = format ? fieldsForFormat(*format) : CommitAllFields;
+    if (output != DiffOutput::None)
+        fields |= CommitTree;
+
+    // Block-buffered: main turns on unitbuf, which would flush every line
+    cout << nounitbuf;
+    string out;
+
+    // The walk is lazy, so stopping here leaves the rest of history unread
+    RevWalk walk(repo->objects(), *head, fields, firstParent);
+    for (long long shown = 0; maxCount < 0 || shown < maxCount;)
     {
-        
-        string mode;
-        while (index < decompressedBuffer.size() && decompressedBuffer[index] != ' ')
+        Result<optional<Commit>> commit = walk.next();
+        if (!commit)
+            return reportError(commit.error());
+        if (!*commit)
+            break;
+
+        const Commit &c = **commit;
+        int64_t time = commitTime(c);
+        if (since && time < *since)
+            break; // newest first, everything after this is older still
+        if (until && time > *until)
+            continue;
+        ++shown;
+
+        if (format)
         {
-            mode += decompressedBuffer[index];
-            index++;
+            out += formatCommit(c, *format) + "\n";
         }
-        index++; // need to skip the space
-
-        string filename;
-        while (index < decompressedBuffer.size() && decompressedBuffer[index] != '\0')
+        else
         {
-            filename += decompressedBuffer[index];
-            index++;
+            out += "commit " + c.hash + "\n";
+            if (!c.parents.empty())
+                out += "Parent: " + c.parents.front() + "\n";
+            if (c.parents.size() > 1)
+            {
+                out += "Merge:";
+                for (size_t i = 1; i < c.parents.size(); ++i)
+                    out += " " + c.parents[i];
+                out += "\n";
+            }
+            out += "Author: " + c.author + "\n";
+            out += "Date:   " + c.committer + "\n";
+            out += "\n    " + c.message + "\n";
         }
-        index++; // need to skip the null byte
-
 
-        unsigned char hash[SHA_DIGEST_LENGTH];
-        if (index + SHA_DIGEST_LENGTH > decompressedBuffer.size())
+        if (output != DiffOutput::None)
         {
-            cerr << "Error: Unexpected end of data while reading hash.\n";
-            return;
+            // Changes against the first parent, with renames paired up
+            string parentTree;
+            if (!c.parents.empty())
+            {
+                Result<Commit> parent = repo->objects().readCommit(c.parents.front(), CommitTree);
+                if (!parent)
+                    return reportError(parent.error());
+                parentTree = parent->tree;
+            }
+            Status status = formatChanges(*repo, parentTree, c.tree, options, output, out);
+            if (!status)
+                return reportError(status.error());
+            out += "\n";
         }
-        memcpy(hash, &decompressedBuffer[index], SHA_DIGEST_LENGTH);
-        index += SHA_DIGEST_LENGTH;
 
-        stringstream ss;
-        for (int i = 0; i < SHA_DIGEST_LENGTH; ++i)
+        if (out.size() >= LOG_FLUSH_SIZE)
         {
-            ss << hex << setw(2) << setfill('0') << static_cast<unsigned int>(hash[i]);
+            cout.write(out.data(), static_cast<streamsize>(out.size()));
+            out.clear();
         }
-        string hashHex = ss.str();
+    }
+    cout.write(out.data(), static_cast<streamsize>(out.size()));
+    cout.flush();
+    return EXIT_SUCCESS;
+}
 
-        string type = (mode == "40000") ? "tree" : "blob";
+int mygitAdd(const vector<string> &files)
+{
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-        if (flag == "--name-only")
-        {
-            cout << filename << endl;
-        }
+    Result<vector<IndexEntry>> entries = repo->add(files);
+    if (!entries)
+        return reportError(entries.error());
+    return EXIT_SUCCESS;
+}
+
+// Gc functions
+
+const size_t AUTO_GC_THRESHOLD = 6700;          // loose objects, same default as git's gc.auto
+const char *const DEFAULT_PRUNE_AGE = "2.weeks.ago";
+
+int mygitGc(const vector<string> &args)
+{
+    string prune = DEFAULT_PRUNE_AGE;
+    bool autoMode = false;
+    for (const string &arg : args)
+    {
+        if (arg.rfind("--prune=", 0) == 0)
+            prune = arg.substr(8);
+        else if (arg == "--no-prune")
+            prune = "never";
+        else if (arg == "--auto")
+            autoMode = true;
         else
         {
-            cout << mode << " " << type << " " << hashHex << " " << filename << endl;
+            cerr << "Usage: ./mygit gc [--prune=<date> | --no-prune] [--auto]\n";
+            return EXIT_FAILURE;
         }
     }
-}
 
-// Log function
-void mygitLog()
-{
-    // We need to read the HEAD file to get the current branch reference
-    ifstream headFile(".git/HEAD");
-    if (!headFile.is_open())
+    int64_t pruneBefore = 0;
+    if (prune != "never")
     {
-        cerr << "Error: Failed to read HEAD.\n";
-        return;
+        Result<int64_t> date = parseDate(prune);
+        if (!date)
+            return reportError(date.error());
+        pruneBefore = *date;
     }
 
-    string refLine;
-    getline(headFile, refLine);
-    headFile.close();
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
+    if (autoMode && !repo->needsGc(AUTO_GC_THRESHOLD))
+        return EXIT_SUCCESS;
+    if (prune == "never")
+        return EXIT_SUCCESS; // nothing else to do without packs
+
+    Result<GcResult> result = repo->gc(pruneBefore);
+    if (!result)
+        return reportError(result.error());
+    cout << "Pruned " << result->pruned << " of " << result->objects << " loose objects\n";
+    return EXIT_SUCCESS;
+}
 
-    string refPath = refLine.substr(5); // Skipping "ref: "
-    string headRefPath = ".git/" + refPath;
+// Like git, commands that create objects check the threshold afterwards. It counts objects
+// written since the last gc, reachable ones stay loose and would otherwise retrigger it.
+// MYGIT_GC_AUTO overrides the threshold, 0 turns it off.
+void autoGc(Repository &repo)
+{
+    size_t threshold = AUTO_GC_THRESHOLD;
+    if (const char *env = getenv("MYGIT_GC_AUTO"))
+        threshold = strtoull(env, nullptr, 10);
+    if (threshold == 0 || !repo.needsGc(threshold))
+        return;
 
-    ifstream refFile(headRefPath);
-    if (!refFile.is_open())
+    Result<int64_t> pruneBefore = parseDate(DEFAULT_PRUNE_AGE);
+    Result<GcResult> result = repo.gc(*pruneBefore);
+    if (!result)
     {
-        cerr << "Error: Failed to read current branch reference.\n";
+        cerr << "Warning: auto gc failed: " << result.error().message << "\n";
         return;
     }
+    cout << "Auto gc: pruned " << result->pruned << " unreachable loose objects\n";
+}
 
-    string commitHash;
-    getline(refFile, commitHash);
-    refFile.close();
+int mygitCommit(const string &message)
+{
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-    // We need to traverse the commit objects
-    while (!commitHash.empty())
-    {
-        string folderName = commitHash.substr(0, 2);
-        string fileName = commitHash.substr(2);
-        string path = ".git/objects/" + folderName + "/" + fileName;
+    Result<string> commitHash = repo->commit(message);
+    if (!commitHash)
+        return reportError(commitHash.error());
 
-        if (!filesystem::exists(path))
+    cout << *commitHash << endl;
+    autoGc(*repo);
+    return EXIT_SUCCESS;
+}
+
+// Branch and tag functions
+
+// Shared by branch and tag: list, "<name> [<start>]" to create, "-d <name>" to delete
+int manageRefs(const string &prefix, const vector<string> &args)
+{
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
+    RefStore &refs = repo->refs();
+
+    if (args.empty())
+    {
+        string current = refs.headRef();
+        for (const auto &ref : refs.list(prefix))
         {
-            cerr << "Error: Commit object not found " << commitHash << "\n";
-            return;
+            if (prefix == "refs/heads/")
+                cout << (ref.first == current ? "* " : "  ");
+            cout << ref.first.substr(prefix.size()) << "\n";
         }
+        return EXIT_SUCCESS;
+    }
 
-        ifstream file(path, ios::binary);
-        if (!file.is_open())
+    if (args[0] == "-d")
+    {
+        if (args.size() != 2)
         {
-            cerr << "Error: Failed to open commit object file.\n";
-            return;
+            cerr << "Usage: ./mygit " << (prefix == "refs/heads/" ? "branch" : "tag") << " -d <name>\n";
+            return EXIT_FAILURE;
         }
-
-        file.seekg(0, ios::end);
-        long long sizeOfFile = file.tellg();
-        file.seekg(0, ios::beg);
-
-        vector<Bytef> buffer(sizeOfFile);
-        file.read(reinterpret_cast<char *>(buffer.data()), sizeOfFile);
-
-        if (file.fail())
+        string refName = prefix + args[1];
+        if (refName == refs.headRef())
         {
-            cerr << "Error: Failed to read commit object file.\n";
-            return;
+            cerr << "Error: Cannot delete the branch '" << args[1] << "' which you are currently on.\n";
+            return EXIT_FAILURE;
         }
-        file.close();
-
-        uLongf decompressedSize = buffer.size() * 100;
-        vector<Bytef> decompressedBuffer(decompressedSize);
-
-        int result = uncompress(decompressedBuffer.data(), &decompressedSize, buffer.data(), buffer.size());
-        if (result != Z_OK)
+        Status status = refs.remove(refName);
+        if (!status && status.error().code != ErrorCode::NotFound)
+            return reportError(status.error()); // locked by a concurrent update
+        if (!status)
         {
-            cerr << "Error: Failed to decompress commit object. Result code: " << result << "\n";
-            return;
+            cerr << "Error: '" << args[1] << "' not found.\n";
+            return EXIT_FAILURE;
         }
+        cout << "Deleted " << args[1] << "\n";
+        return EXIT_SUCCESS;
+    }
 
-        decompressedBuffer.resize(decompressedSize);
+    if (args.size() > 2)
+    {
+        cerr << "Error: Too many arguments\n";
+        return EXIT_FAILURE;
+    }
 
-        string commitContent(decompressedBuffer.begin(), decompressedBuffer.end());
+    const string &name = args[0];
+    if (!isValidRefName(name))
+    {
+        cerr << "Error: '" << name << "' is not a valid name.\n";
+        return EXIT_FAILURE;
+    }
+    if (refs.exists(prefix + name))
+    {
+        cerr << "Error: '" << name << "' already exists.\n";
+        return EXIT_FAILURE;
+    }
 
-        // we need to skip the header
-        size_t nullPos = commitContent.find('\0');
-        if (nullPos == string::npos)
-        {
-            cerr << "Invalid commit object format.\n";
-            return;
-        }
+    string start = args.size() == 2 ? args[1] : "HEAD";
+    Result<string> commitHash = refs.resolve(start);
+    if (!commitHash || !repo->objects().readCommit(*commitHash))
+    {
+        cerr << "Error: Not a valid commit: " << start << "\n";
+        return EXIT_FAILURE;
+    }
 
-        string content = commitContent.substr(nullPos + 1);
+    Status status = refs.update(prefix + name, *commitHash, ""); // fails if it was created meanwhile
+    if (!status)
+        return reportError(status.error());
+    return EXIT_SUCCESS;
+}
 
-        // Parsing the commit content
-        stringstream ss(content);
-        string line;
-        string treeHash, parentHash, author, committer, message;
-        bool messageStarted = false;
+// Checkout function
 
-        while (getline(ss, line))
-        {
-            if (line.rfind("tree ", 0) == 0)
-            {
-                treeHash = line.substr(5);
-            }
-            else if (line.rfind("parent ", 0) == 0)
-            {
-                parentHash = line.substr(7);
-            }
-            else if (line.rfind("author ", 0) == 0)
-            {
-                author = line.substr(7);
-            }
-            else if (line.rfind("committer ", 0) == 0)
-            {
-                committer = line.substr(10);
-            }
-            else if (line.empty())
-            {
-                // Start of the message
-                messageStarted = true;
-                continue;
-            }
-            else if (messageStarted)
-            {
-                message += line + "\n";
-            }
-        }
+int mygitCheckout(const string &target)
+{
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-        cout << "commit " << commitHash << endl;
-        if (!parentHash.empty())
-        {
-            cout << "Parent: " << parentHash << endl;
-        }
-        cout << "Author: " << author << endl;
-        cout << "Date:   " << committer << endl;
-        cout << "\n    " << message << endl;
+    Result<CheckoutResult> result = repo->checkout(target);
+    if (!result)
+        return reportError(result.error());
 
-        // Now we need to move to parent commit
-        commitHash = parentHash;
-    }
+    if (result->branch.empty())
+        cout << "HEAD is now at " << result->commit << "\n";
+    else
+        cout << "Switched to branch '" << target << "'\n";
+    return EXIT_SUCCESS;
 }
 
-void mygitAdd(const vector<string> &files)
+// Sparse checkout function
+
+int mygitSparseCheckout(const vector<string> &args)
 {
-    
-    ofstream indexFile(".git/index", ios::app);
-    if (!indexFile.is_open())
+    if (args.empty())
     {
-        cerr << "Error: Could not open index file.\n";
-        return;
+        cerr << "Usage: ./mygit sparse-checkout (set | add) <dir>... | list | disable\n";
+        return EXIT_FAILURE;
     }
 
-    for (const string &file : files)
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
+
+    const string &subcommand = args[0];
+    if (subcommand == "list")
     {
-        if (filesystem::is_directory(file))
-        {
-            // Recursively adding files
-            for (const auto &entry : filesystem::recursive_directory_iterator(file))
-            {
-                if (entry.is_regular_file())
-                {
-                    string filePath = entry.path().string();
-                    if (filePath.find(".git") != string::npos)
-                        continue; // Exclude files inside .git directory
-
-                    string hash = callCreatingBlobObject(filePath, "-w");
-                    indexFile << hash << " " << filePath << endl;
-                }
-            }
-        }
-        else if (filesystem::is_regular_file(file))
-        {
-            string hash = callCreatingBlobObject(file, "-w");
-            indexFile << hash << " " << file << endl;
-        }
-        else if (file == ".")
-        {
-            
-            for (const auto &entry : filesystem::recursive_directory_iterator("."))
-            {
-                if (entry.is_regular_file())
-                {
-                    string filePath = entry.path().string();
-                    if (filePath.find(".git") != string::npos)
-                        continue;
-
-                    string hash = callCreatingBlobObject(filePath, "-w");
-                    indexFile << hash << " " << filePath << endl;
-                }
-            }
-        }
-        else
+        for (const string &dir : repo->sparseCone())
+            cout << dir << "\n";
+        return EXIT_SUCCESS;
+    }
+    if (subcommand == "disable")
+    {
+        Status status = repo->disableSparseCheckout();
+        return status ? EXIT_SUCCESS : reportError(status.error());
+    }
+    if (subcommand != "set" && subcommand != "add")
+    {
+        cerr << "Unknown sparse-checkout subcommand " << subcommand << "\n";
+        return EXIT_FAILURE;
+    }
+
+    vector<string> directories;
+    if (subcommand == "add")
+    {
+        if (repo->sparseCone().empty())
         {
-            cerr << "Error: " << file << " is not a valid file or directory.\n";
+            cerr << "Error: sparse-checkout is not enabled, use 'set' first.\n";
+            return EXIT_FAILURE;
         }
+        directories = repo->sparseCone();
     }
+    directories.insert(directories.end(), args.begin() + 1, args.end());
 
-    indexFile.close();
+    Status status = repo->setSparseCheckout(directories);
+    return status ? EXIT_SUCCESS : reportError(status.error());
 }
 
-void mygitCommit(const string &message)
+// Merge functions
+
+int mygitMergeBase(const vector<string> &args)
 {
+    bool all = false;
+    vector<string> commits;
+    for (const string &arg : args)
+    {
+        if (arg == "--all")
+            all = true;
+        else
+            commits.push_back(arg);
+    }
+    if (commits.size() != 2)
+    {
+        cerr << "Usage: ./mygit merge-base [--all] <commit> <commit>\n";
+        return EXIT_FAILURE;
+    }
 
-    ifstream indexFile(".git/index");
-    if (!indexFile.is_open())
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
+
+    vector<string> hashes;
+    for (const string &commit : commits)
     {
-        cerr << "Error: No changes added to commit.\n";
-        return;
+        Result<string> hash = repo->refs().resolve(commit);
+        if (!hash || !repo->objects().readCommit(*hash))
+        {
+            cerr << "Not a valid commit: " << commit << "\n";
+            return EXIT_FAILURE;
+        }
+        hashes.push_back(*hash);
     }
 
+    Result<vector<string>> bases = mergeBases(repo->commitGraph(), hashes[0], hashes[1]);
+    if (!bases)
+        return reportError(bases.error());
+    if (bases->empty())
+        return EXIT_FAILURE; // unrelated histories
+
+    for (const string &base : *bases)
+    {
+        cout << base << "\n";
+        if (!all)
+            break;
+    }
+    return EXIT_SUCCESS;
+}
 
-    string treeHash = writeTree(".");
+int mygitMerge(const string &target)
+{
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-    
-    string commitContent;
-    commitContent += "tree " + treeHash + "\n";
+    Result<MergeResult> result = repo->merge(target);
+    if (!result)
+        return reportError(result.error());
 
-    // parent commit SHA
-    ifstream headFile(".git/HEAD");
-    string refLine;
-    getline(headFile, refLine);
-    headFile.close();
+    if (result->upToDate)
+    {
+        cout << "Already up to date.\n";
+    }
+    else if (result->fastForward)
+    {
+        cout << "Fast-forward to " << result->commit << "\n";
+    }
+    else if (!result->conflicts.empty())
+    {
+        for (const string &path : result->conflicts)
+            cout << "CONFLICT: Merge conflict in " << path << "\n";
+        cout << "Automatic merge failed; fix conflicts, add them and commit the result.\n";
+        return EXIT_FAILURE;
+    }
+    else
+    {
+        cout << "Merge made by the three-way strategy: " << result->commit << "\n";
+    }
+    autoGc(*repo);
+    return EXIT_SUCCESS;
+}
 
-    string refPath = refLine.substr(5); // Skipping "ref: "
-    string headRefPath = ".git/" + refPath;
+// Clone function
 
-    ifstream refFile(headRefPath);
-    if (refFile.is_open())
+int mygitClone(const string &source, string destination, bool shared)
+{
+    if (destination.empty())
     {
-        string parentHash;
-        getline(refFile, parentHash);
-        refFile.close();
-        commitContent += "parent " + parentHash + "\n";
+        // Same default as git: last path component of the source
+        destination = filesystem::absolute(source).lexically_normal().filename().string();
+        if (destination.empty())
+            destination = filesystem::absolute(source).lexically_normal().parent_path().filename().string();
     }
 
-    
-    time_t now = time(nullptr);
-    char timeStr[100];
-    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S %z", localtime(&now));
+    cout << "Cloning into '" << destination << "'...\n";
+
+    Result<CloneResult> result = clone(source, destination, shared);
+    if (!result)
+        return reportError(result.error());
 
-    commitContent += "author : <VaibhavGupta@gmail.com> " + string(timeStr) + "\n";
-    commitContent += "committer : <VaibhavGupta@gmail.com> " + string(timeStr) + "\n\n";
-    commitContent += message + "\n";
+    if (!shared)
+        cout << "Linked " << result->linked << " and copied " << result->copied << " object files\n";
+    return EXIT_SUCCESS;
+}
 
-    
-    string commitObj = "commit " + to_string(commitContent.size()) + '\0' + commitContent;
+// Grep function
 
-    
-    unsigned char hash[SHA_DIGEST_LENGTH];
-    SHA1(reinterpret_cast<const unsigned char *>(commitObj.c_str()), commitObj.size(), hash);
+int mygitGrep(const vector<string> &args)
+{
+    GrepOptions options;
+    bool lineNumbers = false, namesOnly = false, havePattern = false;
+    vector<string> revisions;
 
-    stringstream ss;
-    for (int i = 0; i < SHA_DIGEST_LENGTH; ++i)
+    for (size_t i = 0; i < args.size(); ++i)
     {
-        ss << hex << setw(2) << setfill('0') << static_cast<unsigned int>(hash[i]);
+        const string &arg = args[i];
+        if (arg == "--")
+        {
+            options.pathspecs.assign(args.begin() + i + 1, args.end());
+            break;
+        }
+        else if (arg == "-i")
+            options.ignoreCase = true;
+        else if (arg == "-F")
+            options.fixedStrings = true;
+        else if (arg == "-n")
+            lineNumbers = true;
+        else if (arg == "-l")
+            namesOnly = true;
+        else if (arg == "-e" && i + 1 < args.size() && !havePattern)
+        {
+            options.pattern = args[++i];
+            havePattern = true;
+        }
+        else if (!havePattern)
+        {
+            options.pattern = arg;
+            havePattern = true;
+        }
+        else
+            revisions.push_back(arg);
     }
-    string commitHash = ss.str();
 
-    // Writing the commit object to the .git/objects directory
-    string folder = commitHash.substr(0, 2);
-    string fileNamePart = commitHash.substr(2);
-    string folderPath = ".git/objects/" + folder;
-
-    if (!filesystem::exists(folderPath))
+    if (!havePattern || revisions.size() > 1)
     {
-        filesystem::create_directory(folderPath);
+        cerr << "Usage: ./mygit grep [-i] [-F] [-n] [-l] <pattern> [<commit>] [-- <path>...]\n";
+        return EXIT_FAILURE;
     }
 
-    uLongf compressedSize = compressBound(commitObj.size());
-    vector<unsigned char> compressedBuffer(compressedSize);
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-    int result = compress(compressedBuffer.data(), &compressedSize,
-                          reinterpret_cast<const Bytef *>(commitObj.data()), commitObj.size());
-    if (result != Z_OK)
+    string revision = revisions.empty() ? "HEAD" : revisions[0];
+    Result<string> commitHash = repo->refs().resolve(revision);
+    if (!commitHash)
+        return reportError(commitHash.error());
+    Result<Commit> commit = repo->objects().readCommit(*commitHash);
+    if (!commit)
+        return reportError(commit.error());
+
+    Result<vector<GrepMatch>> matches = grep(repo->objects(), commit->tree, options);
+    if (!matches)
+        return reportError(matches.error());
+
+    // Like git, results from an explicit revision are prefixed with it
+    string prefix = revisions.empty() ? "" : revision + ":";
+    string out;
+    string lastPath;
+    for (const auto &match : *matches)
     {
-        cerr << "Error: Failed to compress commit object. Result code: " << result << "\n";
-        return;
+        if (namesOnly)
+        {
+            if (match.path != lastPath)
+                out += prefix + match.path + "\n";
+            lastPath = match.path;
+            continue;
+        }
+        out += prefix + match.path + ":";
+        if (lineNumbers)
+            out += to_string(match.lineNumber) + ":";
+        out += match.line + "\n";
     }
+    cout << out;
 
-    compressedBuffer.resize(compressedSize);
+    return matches->empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Archive function
 
-    // Write the compressed commit object to the file
-    ofstream outFile(folderPath + "/" + fileNamePart, ios::binary);
-    if (!outFile.is_open())
+int mygitArchive(const vector<string> &args)
+{
+    string format, prefix, output;
+    vector<string> revisions;
+    for (size_t i = 0; i < args.size(); ++i)
     {
-        cerr << "Error: Failed to write commit object.\n";
-        return;
+        const string &arg = args[i];
+        if (arg.rfind("--format=", 0) == 0)
+            format = arg.substr(9);
+        else if (arg.rfind("--prefix=", 0) == 0)
+            prefix = arg.substr(9);
+        else if (arg == "-o" && i + 1 < args.size())
+            output = args[++i];
+        else
+            revisions.push_back(arg);
     }
 
-    outFile.write(reinterpret_cast<const char *>(compressedBuffer.data()),
-                  static_cast<std::streamsize>(compressedSize));
-    outFile.close();
-
-    // Update the HEAD reference
-    ofstream refFileOut(headRefPath);
-    if (!refFileOut.is_open())
+    // Like git, the format can come from the output file name
+    if (format.empty())
     {
-        cerr << "Error: Failed to update HEAD reference.\n";
-        return;
+        auto endsWith = [&](const string &suffix)
+        { return output.size() >= suffix.size() && output.compare(output.size() - suffix.size(), suffix.size(), suffix) == 0; };
+        format = endsWith(".tar.gz") || endsWith(".tgz") ? "tar.gz" : "tar";
     }
-    refFileOut << commitHash << endl;
-    refFileOut.close();
 
-    //  Now Clearing the index file
-    ofstream indexFileOut(".git/index", ofstream::trunc);
-    indexFileOut.close();
+    if (revisions.size() != 1 || (format != "tar" && format != "tar.gz" && format != "tgz"))
+    {
+        cerr << "Usage: ./mygit archive [--format=tar|tar.gz] [--prefix=<dir>/] [-o <file>] <commit>\n";
+        return EXIT_FAILURE;
+    }
 
-    cout << commitHash << endl;
-}
+    unique_ptr<Repository> repo = openRepository();
+    if (!repo)
+        return EXIT_FAILURE;
 
-// Checkout function
+    Result<string> commitHash = repo->refs().resolve(revisions[0]);
+    if (!commitHash)
+        return reportError(commitHash.error());
 
+    ofstream outFile;
+    if (!output.empty())
+    {
+        outFile.open(output, ios::binary | ios::trunc);
+        if (!outFile.is_open())
+        {
+            cerr << "Error: Failed to open " << output << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    else
+    {
+        cout << nounitbuf; // the archive is written in large chunks
+    }
 
+    ArchiveFormat archiveFormat = format == "tar" ? ArchiveFormat::Tar : ArchiveFormat::TarGz;
+    Status status = writeArchive(repo->objects(), *commitHash, archiveFormat, prefix,
+                                 output.empty() ? static_cast<ostream &>(cout) : outFile);
+    if (!status)
+        return reportError(status.error());
+    return EXIT_SUCCESS;
+}
 
 int main(int argc, char *argv[])
 {
-    
+
     cout << std::unitbuf;
     cerr << std::unitbuf;
 
@@ -653,32 +993,14 @@ int main(int argc, char *argv[])
 
     if (command == "init")
     {
-        try
+        Result<unique_ptr<Repository>> repo = Repository::init(".");
+        if (!repo)
         {
-            filesystem::create_directory(".git");
-            filesystem::create_directory(".git/objects");
-            filesystem::create_directory(".git/refs");
-            filesystem::create_directory(".git/refs/heads");
-
-            ofstream headFile(".git/HEAD");
-            if (headFile.is_open())
-            {
-                headFile << "ref: refs/heads/main\n";
-                headFile.close();
-            }
-            else
-            {
-                cerr << "Failed to create .git/HEAD file.\n";
-                return EXIT_FAILURE;
-            }
-
-            cout << "Initialized git directory\n";
-        }
-        catch (const std::filesystem::filesystem_error &e)
-        {
-            cerr << e.what() << '\n';
+            cerr << repo.error().message << '\n';
             return EXIT_FAILURE;
         }
+
+        cout << "Initialized git directory\n";
     }
     else if (command == "cat-file")
     {
@@ -688,94 +1010,35 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
 
-        string shaOfBlob = argv[3];
-        string folderName = shaOfBlob.substr(0, 2);
-        string fileName = shaOfBlob.substr(2);
-        string path = ".git/objects/" + folderName + "/" + fileName;
+        unique_ptr<Repository> repo = openRepository();
+        if (!repo)
+            return EXIT_FAILURE;
 
-        if (!filesystem::exists(path))
+        // read also looks in alternate object stores
+        string shaOfBlob = argv[3];
+        Result<Object> object = repo->objects().read(shaOfBlob);
+        if (!object)
         {
             cerr << "Not a valid object name " << shaOfBlob << "\n";
             return EXIT_FAILURE;
         }
 
-        ifstream file(path, ios::binary);
-        if (!file.is_open())
+        if (string(argv[2]) == "-p")
         {
-            cerr << "Error: Failed to open file.\n";
-            return EXIT_FAILURE;
+            cout << object->content << endl;
         }
-
-        file.seekg(0, ios::end);
-        long long sizeOfFile = file.tellg();
-        file.seekg(0, ios::beg);
-
-        if (sizeOfFile > 0)
+        else if (string(argv[2]) == "-t")
         {
-            
-            vector<Bytef> buffer(sizeOfFile);
-            file.read(reinterpret_cast<char *>(buffer.data()), sizeOfFile);
-            file.close();
-
-            if (file.fail())
-            {
-                cerr << "Error: Failed to read file.\n";
-                return EXIT_FAILURE;
-            }
-
-            
-            uLongf decompressedSize = buffer.size() * 100;
-            vector<Bytef> decompressedBuffer(decompressedSize);
-
-            int result = uncompress(decompressedBuffer.data(), &decompressedSize, buffer.data(), buffer.size());
-            if (result != Z_OK)
-            {
-                cerr << "Error: Failed to decompress data. Result code: " << result << "\n";
-                return EXIT_FAILURE;
-            }
-
-            
-            decompressedBuffer.resize(decompressedSize);
-
-            
-            if (string(argv[2]) == "-p")
-            {
-                
-                auto start = find(decompressedBuffer.begin(), decompressedBuffer.end(), '\0');
-                if (start != decompressedBuffer.end())
-                {
-                    ++start; // Move to the character after the null character
-                    for (auto it = start; it != decompressedBuffer.end(); ++it)
-                    {
-                        cout << *it;
-                    }
-                    cout << endl;
-                }
-            }
-            else if (string(argv[2]) == "-t")
-            {
-            
-                auto end = find(decompressedBuffer.begin(), decompressedBuffer.end(), ' ');
-                string type(decompressedBuffer.begin(), end);
-                cout << "Type: " << type << endl;
-            }
-            else if (string(argv[2]) == "-s")
-            {
-                // Extract size by reading until the first null character after the first space
-                auto spaceIt = find(decompressedBuffer.begin(), decompressedBuffer.end(), ' ');
-                if (spaceIt != decompressedBuffer.end())
-                {
-                    ++spaceIt; // Move to the start of the size
-                    auto nullIt = find(spaceIt, decompressedBuffer.end(), '\0');
-                    string sizeStr(spaceIt, nullIt);
-                    cout << "Size: " << sizeStr << endl;
-                }
-            }
-            else
-            {
-                cerr << "Invalid flag provided. Use -p, -t, or -s.\n";
-                return EXIT_FAILURE;
-            }
+            cout << "Type: " << object->type << endl;
+        }
+        else if (string(argv[2]) == "-s")
+        {
+            cout << "Size: " << object->content.size() << endl;
+        }
+        else
+        {
+            cerr << "Invalid flag provided. Use -p, -t, or -s.\n";
+            return EXIT_FAILURE;
         }
     }
 
@@ -813,14 +1076,18 @@ int main(int argc, char *argv[])
     }
     else if (command == "write-tree")
     {
-        string treeHash = writeTree(".");
-        if (!treeHash.empty())
+        unique_ptr<Repository> repo = openRepository();
+        if (!repo)
+            return EXIT_FAILURE;
+
+        Result<string> treeHash = repo->writeTree();
+        if (treeHash)
         {
-            cout << treeHash << endl;
+            cout << *treeHash << endl;
         }
         else
         {
-            cerr << "Failed to write tree.\n";
+            cerr << "Failed to write tree: " << treeHash.error().message << "\n";
             return EXIT_FAILURE;
         }
     }
@@ -845,7 +1112,7 @@ int main(int argc, char *argv[])
             treeHash = argv[2];
         }
 
-        lsTree(treeHash, flag);
+        return lsTree(treeHash, flag);
     }
     else if (command == "add")
     {
@@ -861,7 +1128,7 @@ int main(int argc, char *argv[])
             files.push_back(argv[i]);
         }
 
-        mygitAdd(files);
+        return mygitAdd(files);
     }
     else if (command == "commit")
     {
@@ -876,23 +1143,96 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
 
-        mygitCommit(message);
+        return mygitCommit(message);
+    }
+    else if (command == "checkout")
+    {
+        if (argc != 3)
+        {
+            cerr << "Usage: ./mygit checkout <branch|commit_hash>\n";
+            return EXIT_FAILURE;
+        }
+
+        return mygitCheckout(argv[2]);
+    }
+    else if (command == "clone")
+    {
+        bool shared = false;
+        vector<string> paths;
+        for (int i = 2; i < argc; ++i)
+        {
+            if (string(argv[i]) == "--shared" || string(argv[i]) == "-s")
+                shared = true;
+            else
+                paths.push_back(argv[i]);
+        }
+
+        if (paths.empty() || paths.size() > 2)
+        {
+            cerr << "Usage: ./mygit clone [--shared] <local-path> [<directory>]\n";
+            return EXIT_FAILURE;
+        }
+
+        return mygitClone(paths[0], paths.size() == 2 ? paths[1] : "", shared);
+    }
+    else if (command == "branch")
+    {
+        return manageRefs("refs/heads/", vector<string>(argv + 2, argv + argc));
+    }
+    else if (command == "tag")
+    {
+        return manageRefs("refs/tags/", vector<string>(argv + 2, argv + argc));
     }
-    // else if (command == "checkout")
-    // {
-    //     if (argc != 3)
-    //     {
-    //         cerr << "Usage: ./mygit checkout <commit_hash>\n";
-    //         return EXIT_FAILURE;
-    //     }
+    else if (command == "grep")
+    {
+        return mygitGrep(vector<string>(argv + 2, argv + argc));
+    }
+    else if (command == "archive")
+    {
+        return mygitArchive(vector<string>(argv + 2, argv + argc));
+    }
+    else if (command == "merge-base")
+    {
+        return mygitMergeBase(vector<string>(argv + 2, argv + argc));
+    }
+    else if (command == "merge")
+    {
+        if (argc != 3)
+        {
+            cerr << "Usage: ./mygit merge <branch|commit>\n";
+            return EXIT_FAILURE;
+        }
+        return mygitMerge(argv[2]);
+    }
+    else if (command == "sparse-checkout")
+    {
+        return mygitSparseCheckout(vector<string>(argv + 2, argv + argc));
+    }
+    else if (command == "gc")
+    {
+        return mygitGc(vector<string>(argv + 2, argv + argc));
+    }
+    else if (command == "pack-refs")
+    {
+        unique_ptr<Repository> repo = openRepository();
+        if (!repo)
+            return EXIT_FAILURE;
 
-    //     string commitHash = argv[2];
-    //     mygitCheckout(commitHash);
-    // }
+        Status status = repo->refs().packRefs();
+        if (!status)
+        {
+            cerr << "Failed to pack refs: " << status.error().message << "\n";
+            return EXIT_FAILURE;
+        }
+    }
 
     else if (command == "log")
     {
-        mygitLog();
+        return mygitLog(vector<string>(argv + 2, argv + argc));
+    }
+    else if (command == "diff")
+    {
+        return mygitDiff(vector<string>(argv + 2, argv + argc));
     }
     else
     {
@@ -902,4 +1242,3 @@ int main(int argc, char *argv[])
 
     return EXIT_SUCCESS;
 }
-